@@ -0,0 +1,253 @@
+template<class F>
+static double bench_seconds(F&& fn){
+    auto t0 = std::chrono::steady_clock::now();
+    fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+static void bench_report(const string& label, size_t bytes, double secs){
+    double mbs = secs > 0 ? (double)bytes / (1024.0*1024.0) / secs : 0.0;
+    cout<<"  "<<std::left<<std::setw(22)<<label<<std::right
+        <<std::setw(10)<<std::fixed<<std::setprecision(1)<<mbs<<" MB/s  "
+        <<std::setprecision(3)<<secs<<" s"<<std::defaultfloat<<"\n";
+}
+
+static string bench_text(size_t bytes, bool ascii_only){
+    static const char* words[] = {
+        "GET", "/api/v1/items", "status=200", "latency_ms=12", "user=alice",
+        "warn", "retrying", "connection", "timeout", "config.yaml", "ok"
+    };
+    static const char* accents[] = { "caf\xC3\xA9", "na\xC3\xAFve", "se\xC3\xB1or" };
+    std::mt19937 rng(1234);
+    string s; s.reserve(bytes + 128);
+    size_t col = 0;
+    while(s.size() < bytes){
+        unsigned r = rng();
+        const char* w = (!ascii_only && r % 17 == 0)? accents[r % 3] : words[r % 11];
+        s += w;
+        col += std::strlen(w);
+        if(col > 70){ s.push_back('\n'); col = 0; }
+        else s.push_back(' ');
+    }
+    return s;
+}
+
+static void bench_encoding(size_t mb){
+    string text = bench_text(mb*1024*1024, false);
+    string ascii = bench_text(mb*1024*1024, true);
+    string wide, back, l1;
+    cout<<"encoding ("<<human_bytes(text.size())<<" of UTF-8 text)\n";
+    bench_report("utf8 -> utf16le", text.size(), bench_seconds([&]{ utf8_to_utf16(text.data(), text.size(), false, wide); }));
+    bench_report("utf16le -> utf8", wide.size(), bench_seconds([&]{ utf16_to_utf8(wide.data(), wide.size(), false, back); }));
+    bench_report("utf8 -> latin1", text.size(), bench_seconds([&]{ utf8_to_latin1(text.data(), text.size(), l1); }));
+    bench_report("latin1 -> utf8", l1.size(), bench_seconds([&]{ latin1_to_utf8(l1.data(), l1.size(), back); }));
+    volatile bool valid = false;
+    bench_report("utf8 validate", text.size(), bench_seconds([&]{ valid = utf8_valid(text.data(), text.size()); }));
+    bench_report("ascii -> utf16le", ascii.size(), bench_seconds([&]{ utf8_to_utf16(ascii.data(), ascii.size(), false, wide); }));
+    bench_report("utf16le(ascii) -> utf8", wide.size(), bench_seconds([&]{ utf16_to_utf8(wide.data(), wide.size(), false, back); }));
+    if(back != ascii || !valid) cout<<"  warning: round trip mismatch\n";
+}
+
+static void bench_lines(size_t mb, vector<string>& lines){
+    string text = bench_text(mb*1024*1024, true);
+    lines.clear();
+    split_lines(text, lines);
+}
+
+static void bench_search(size_t mb){
+    Buffer b;
+    bench_lines(mb, b.lines);
+    size_t bytes = char_count(b);
+    string flat;
+    flat.reserve(bytes);
+    for(auto& L: b.lines){ flat += L; flat.push_back('\n'); }
+    cout<<"search ("<<human_bytes(bytes)<<", "<<b.lines.size()<<" lines)\n";
+    vector<size_t> hits;
+    size_t ref = 0, got = 0;
+    bench_report("copy+find", bytes, bench_seconds([&]{
+        ref = 0;
+        for(auto& L: b.lines){ string c = L; if(c.find("timeout")!=string::npos) ref++; }
+    }));
+    bench_report("simd find", bytes, bench_seconds([&]{ got = search_plain_allhits(b, "timeout", false, hits); }));
+    if(got != ref) cout<<"  warning: hit count mismatch ("<<got<<" vs "<<ref<<")\n";
+    bench_report("lower+find (icase)", bytes, bench_seconds([&]{
+        ref = 0;
+        for(auto& L: b.lines) if(lower(L).find("timeout")!=string::npos) ref++;
+    }));
+    bench_report("simd findi", bytes, bench_seconds([&]{ got = search_plain_allhits(b, "TimeOut", true, hits); }));
+    if(got != ref) cout<<"  warning: hit count mismatch ("<<got<<" vs "<<ref<<")\n";
+    LiteralMatcher cs("timeout", false), ci("TIMEOUT", true);
+    for(auto* lm: {&cs, &ci}){
+        size_t n = 0;
+        double t = bench_seconds([&]{
+            const char* p = flat.data(); const char* end = p + flat.size();
+            while(p < end){
+                const char* h = lm->find(p, (size_t)(end-p));
+                if(!h) break;
+                n++;
+                const char* nl = (const char*)std::memchr(h, '\n', (size_t)(end-h));
+                p = nl? nl+1 : end;
+            }
+        });
+        bench_report(lm->icase? "contiguous findi" : "contiguous find", flat.size(), t);
+        if(n != got) cout<<"  warning: hit count mismatch ("<<n<<" vs "<<got<<")\n";
+    }
+    WorkerPool& pool = WorkerPool::get();
+    size_t saved = pool.limit, workers = pool.size();
+    if(saved == 1) workers = WorkerPool::hardware();
+    Regex rx("latency_ms=1[0-9]+");
+    for(size_t t: {(size_t)1, workers}){
+        pool.limit = t;
+        string tag = " (" + std::to_string(t) + (t==1? " thread)" : " threads)");
+        bench_report("findi" + tag, bytes, bench_seconds([&]{ search_plain_allhits(b, "TimeOut", true, hits); }));
+        bench_report("findre" + tag, bytes, bench_seconds([&]{ search_regex_allhits(b, rx, hits); }));
+        if(workers == 1) break;
+    }
+    pool.limit = saved;
+}
+
+static void bench_regex(size_t mb){
+    Buffer b;
+    bench_lines(mb, b.lines);
+    size_t bytes = char_count(b);
+    cout<<"regex ("<<human_bytes(bytes)<<", "<<b.lines.size()<<" lines)\n";
+    static const char* pats[] = {
+        "latency_ms=1[0-9]+", "(GET|POST) /api/v[0-9]+/\\w+", "\\btimeout\\b", "ok$", "us(er|e)=[a-z]+ warn"
+    };
+    for(const char* pat: pats){
+        cout<<"  /"<<pat<<"/\n";
+        size_t ref = 0, got = 0;
+        std::regex srx(pat, std::regex::ECMAScript);
+        Regex rx(pat);
+        bench_report("std::regex", bytes, bench_seconds([&]{
+            ref = 0;
+            for(auto& L: b.lines) if(std::regex_search(L, srx)) ref++;
+        }));
+        bench_report("tedit regex", bytes, bench_seconds([&]{
+            got = 0;
+            for(auto& L: b.lines) if(rx.search(L)) got++;
+        }));
+        if(got != ref) cout<<"  warning: hit count mismatch ("<<got<<" vs "<<ref<<")\n";
+    }
+    cout<<"  replace /\\b(GET|ok|warn)\\b/ -> <$&>\n";
+    std::regex skw(R"(\b(GET|ok|warn)\b)");
+    Regex kw(R"(\b(GET|ok|warn)\b)");
+    size_t ref = 0, got = 0;
+    bench_report("std::regex_replace", bytes, bench_seconds([&]{
+        ref = 0;
+        for(auto& L: b.lines) ref += std::regex_replace(L, skw, "<$&>").size();
+    }));
+    bench_report("re_replace", bytes, bench_seconds([&]{
+        got = 0;
+        for(auto& L: b.lines) got += re_replace(L, kw, "<$&>").size();
+    }));
+    if(got != ref) cout<<"  warning: output size mismatch ("<<got<<" vs "<<ref<<")\n";
+}
+
+static void bench_subst(size_t mb){
+    vector<string> lines;
+    bench_lines(mb, lines);
+    size_t bytes = 0;
+    for(auto& L: lines) bytes += L.size() + 1;
+    cout<<"substitute s/latency_ms=([0-9]+)/ms=$1/g ("<<human_bytes(bytes)<<", "<<lines.size()<<" lines)\n";
+    vector<string> piped = lines;
+    string err;
+    bool ok = false;
+    bench_report("filter !sed -E", bytes, bench_seconds([&]{
+        ok = run_filter_replace(piped, 1, piped.size(), "sed -E 's/latency_ms=([0-9]+)/ms=\\1/g'", err);
+    }));
+    Regex rx("latency_ms=([0-9]+)");
+    vector<LineEdit> edits;
+    bench_report("substitute_lines", bytes, bench_seconds([&]{
+        substitute_lines(lines, 0, lines.size(), rx, "ms=$1", true, edits);
+    }));
+    for(auto& e: edits) lines[e.idx].swap(e.text);
+    if(!ok) cout<<"  warning: sed failed: "<<err<<"\n";
+    else if(piped != lines) cout<<"  warning: output mismatch\n";
+}
+
+// Lexer throughput per language on repeated sample lines, with the old
+// chain of regex replacements as the C++ reference.
+static void bench_highlight(size_t mb){
+    struct Sample{ Lang lang; const char* name; vector<string> lines; };
+    const vector<Sample> samples = {
+        {Lang::Cpp, "cpp", {
+            "static int parse_long(const string& s, long& out){ // returns false on junk",
+            "    for(auto& kv: post) m += 32 + sizeof(kv) + kv.second.capacity()*sizeof(uint32_t);",
+            "    if(!ok){ cout<<\"write: \"<<err<<\"\\n\"; return false; }",
+            "template<class T> struct Pool{ virtual ~Pool() = default; };"}},
+        {Lang::Python, "python", {
+            "def load(path, mode='r'):  # open and parse",
+            "    with open(path, mode) as f: return [l.rstrip(\"\\n\") for l in f if l]",
+            "class Cache(object): pass",
+            "    raise ValueError('bad value: %r' % (x,)) if x is None else x"}},
+        {Lang::Shell, "shell", {
+            "for f in \"$@\"; do echo \"${f%.c}.o\" $HOME; done  # build list",
+            "if [ -z \"$PREFIX\" ]; then PREFIX=/usr/local; fi",
+            "case $1 in start) run 'daemon' ;; *) exit 1 ;; esac"}},
+        {Lang::Ruby, "ruby", {
+            "class Cache < Base  # memoised lookups",
+            "  def fetch(key) return @store[key] if @store.key?(key); nil end",
+            "  puts \"miss: #{key}\" unless quiet; yield self if block_given?"}},
+        {Lang::JS, "js", {
+            "export async function fetchAll(urls){ return await Promise.all(urls.map(u => get(u))); }",
+            "const key = `item-${id}`; let v = cache[key] ?? null; // lookup",
+            "if(x === undefined || x === null){ throw new Error('missing'); }"}},
+        {Lang::HTML, "html", {
+            "<div class=\"row\"><span id='n'>42</span><!-- count --></div>",
+            "<a href=\"/docs/index.html\">Docs</a> &middot; <b>bold</b>"}},
+        {Lang::CSS, "css", {
+            ".nav a:hover { color: #fff; background-color: rgba(0,0,0,.5); } /* hover */",
+            "@media (max-width: 600px) { body { margin: 0; font-size: 14px; } }"}},
+        {Lang::JSON, "json", {
+            "{\"id\": 17, \"name\": \"widget\", \"tags\": [\"a\", \"b\"], \"active\": true, \"parent\": null}"}},
+    };
+    Buffer b; b.highlight = true;
+    ThemePalette P = palette_for(Theme::Dark);
+    size_t want = mb*1024*1024;
+    auto report = [](const string& label, size_t bytes, size_t nlines, double secs){
+        double mbs = secs > 0 ? (double)bytes / (1024.0*1024.0) / secs : 0.0;
+        double lps = secs > 0 ? (double)nlines / secs : 0.0;
+        cout<<"  "<<std::left<<std::setw(22)<<label<<std::right
+            <<std::setw(10)<<std::fixed<<std::setprecision(1)<<mbs<<" MB/s "
+            <<std::setw(12)<<std::setprecision(0)<<lps<<" lines/s"<<std::defaultfloat<<"\n";
+    };
+    cout<<"highlight (~"<<human_bytes(want)<<" per language)\n";
+    if(!use_color()) cout<<"  note: colour is off (NO_COLOR or not a terminal); spans are still computed\n";
+    vector<HlSpan> spans;
+    string out;
+    for(auto& s: samples){
+        vector<string> lines;
+        size_t bytes = 0;
+        for(size_t k=0; bytes < want; ++k){ lines.push_back(s.lines[k % s.lines.size()]); bytes += lines.back().size() + 1; }
+        const LangSpec& sp = lang_spec(s.lang);
+        report(s.name, bytes, lines.size(), bench_seconds([&]{
+            for(auto& L: lines){ lex_line(sp, L, spans); render_spans(L, spans, P, out); }
+        }));
+        if(s.lang != Lang::Cpp) continue;
+        // Repaging: every line is already in the highlight cache.
+        HlCache cache;
+        for(auto& L: lines) if(!cache.find(HlCache::key_for(L, s.lang, 0), L.size())) cache.put(HlCache::key_for(L, s.lang, 0), L.size(), lex_line(sp, L, spans), spans);
+        report("cpp (cached)", bytes, lines.size(), bench_seconds([&]{
+            for(auto& L: lines){
+                const HlCache::Entry* hit = cache.find(HlCache::key_for(L, s.lang, 0), L.size());
+                render_spans(L, hit? hit->spans : spans, P, out);
+            }
+        }));
+        // The old highlighter: three regex passes per line.
+        auto str = compiled_regex(R"("([^"\\]|\\.)*")");
+        auto com = compiled_regex(R"(//.*$)");
+        auto kw = compiled_regex(R"(\b(auto|break|case|class|const|continue|default|delete|do|else|enum|for|friend|if|inline|namespace|new|noexcept|operator|private|protected|public|return|sizeof|static|struct|switch|template|this|throw|try|typedef|typename|union|using|virtual|void|volatile|while)\b)");
+        size_t sub = std::min(lines.size(), (size_t)20000);
+        size_t sub_bytes = 0;
+        for(size_t k=0;k<sub;++k) sub_bytes += lines[k].size() + 1;
+        report("cpp (regex chain)", sub_bytes, sub, bench_seconds([&]{
+            for(size_t k=0;k<sub;++k){
+                string t = re_replace(lines[k], *str, P.accent+"$&"+C_RESET);
+                t = re_replace(t, *com, P.dim+"$&"+C_RESET);
+                out = re_replace(t, *kw, P.ok+"$&"+C_RESET);
+            }
+        }));
+    }
+}
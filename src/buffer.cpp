@@ -1,20 +1,68 @@
+struct TrigramIndex;
+
+static uint64_t next_buffer_id(){ static uint64_t n = 0; return ++n; }
+
 struct Buffer{
+    uint64_t id = next_buffer_id();
     string path;
     vector<string> lines;
     bool dirty=false;
     bool number=true;
     bool backup=true;
     bool highlight=false;
+    bool streaming=false;
+    Encoding enc=Encoding::Utf8;
+    bool bom=false;
+    std::shared_ptr<TrigramIndex> tri;
 };
 
 static size_t char_count(const Buffer& b){ size_t t=0; for(auto& L: b.lines) t += L.size()+1; return t; }
 
 
-struct Snap{ vector<string> lines; };
+// An undo step. Full keeps the whole previous buffer; Changed keeps only
+// the previous text of lines rewritten in place (same line count), as
+// recorded by repl. The stacks are shared by all buffers, so each step
+// names the Buffer::id it belongs to. Applying a step turns it into its
+// inverse for the other stack.
+struct Snap{
+    enum Kind : uint64_t { Full = 0, Changed = 1 };
+    Kind kind = Full;
+    vector<string> lines;
+    vector<size_t> at;
+    uint64_t buf_id = 0;
+};
 static const size_t UNDO_MAX=200;
 struct Stack{
     vector<Snap> st;
     void clear(){ for(auto& s: st) s.lines.clear(); st.clear(); }
-    void push(const Buffer& b){ if(st.size()==UNDO_MAX) st.erase(st.begin()); st.push_back(Snap{b.lines}); }
-    bool pop(Snap& s){ if(st.empty()) return false; s=st.back(); st.pop_back(); return true; }
+    void push(Snap s){ if(st.size()==UNDO_MAX) st.erase(st.begin()); st.push_back(std::move(s)); }
+    void push(const Buffer& b){ push(Snap{Snap::Full, b.lines, {}, b.id}); }
+    bool pop(Snap& s){ if(st.empty()) return false; s=std::move(st.back()); st.pop_back(); return true; }
+    // Forgets every step of a buffer that was closed or replaced.
+    void drop(uint64_t id){
+        st.erase(std::remove_if(st.begin(), st.end(), [id](const Snap& s){ return s.buf_id == id; }), st.end());
+    }
 };
+
+// True when every Changed step of b in stk, applied from the top down
+// starting at b's current text, only touches lines that exist then.
+static bool snaps_fit(const Stack& stk, const Buffer& b){
+    size_t lines = b.lines.size();
+    for(size_t k=stk.st.size(); k-- > 0;){
+        const Snap& s = stk.st[k];
+        if(s.buf_id != b.id) continue;
+        if(s.kind == Snap::Full){ lines = s.lines.size(); continue; }
+        if(!s.at.empty() && s.at.back() >= lines) return false;
+    }
+    return true;
+}
+
+// Applies s to b and leaves its inverse in s. Refuses, leaving both
+// untouched, a step of another buffer or one addressing missing lines.
+static bool apply_snap(Snap& s, Buffer& b){
+    if(s.buf_id != b.id) return false;
+    if(s.kind == Snap::Full){ std::swap(s.lines, b.lines); return true; }
+    if(!s.at.empty() && s.at.back() >= b.lines.size()) return false;
+    for(size_t k=0;k<s.at.size();++k) b.lines[s.at[k]].swap(s.lines[k]);
+    return true;
+}
@@ -0,0 +1,111 @@
+// Substring search over raw bytes. The SSE2 path compares the first and
+// last pattern byte against 16 candidate positions at once and only runs
+// memcmp where both agree, which skips almost all of the haystack.
+static const unsigned char* find_bytes(const unsigned char* h, size_t n, const unsigned char* pat, size_t m){
+    if(m == 0) return h;
+    if(m > n) return nullptr;
+    if(m == 1) return (const unsigned char*)std::memchr(h, pat[0], n);
+    size_t i = 0;
+#if defined(TEDIT_SSE2)
+    const __m128i first = _mm_set1_epi8((char)pat[0]);
+    const __m128i last  = _mm_set1_epi8((char)pat[m-1]);
+    for(; i + m - 1 + 16 <= n; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(h+i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(h+i+m-1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while(mask){
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if(std::memcmp(h+i+bit+1, pat+1, m-2) == 0) return h+i+bit;
+            mask &= mask-1;
+        }
+    }
+#endif
+    while(i + m <= n){
+        const unsigned char* c = (const unsigned char*)std::memchr(h+i, pat[0], n-m+1-i);
+        if(!c) return nullptr;
+        if(c[m-1]==pat[m-1] && std::memcmp(c+1, pat+1, m-2) == 0) return c;
+        i = (size_t)(c-h) + 1;
+    }
+    return nullptr;
+}
+
+static bool parse_byte_pattern(const string& in, string& out, string& err){
+    string s = trim_copy(in);
+    out.clear();
+    if(s.size()>=2 && s.front()=='"' && s.back()=='"'){
+        out = s.substr(1, s.size()-2);
+        if(out.empty()){ err = "empty pattern"; return false; }
+        return true;
+    }
+    string hex;
+    for(size_t i=0;i<s.size();++i){
+        char c = s[i];
+        if(std::isspace((unsigned char)c)) continue;
+        if(c=='0' && i+1<s.size() && (s[i+1]=='x'||s[i+1]=='X')){ i++; continue; }
+        if(!std::isxdigit((unsigned char)c)){ err = string("not a hex digit: ") + c; return false; }
+        hex.push_back(c);
+    }
+    if(hex.empty()){ err = "empty pattern"; return false; }
+    if(hex.size() % 2){ err = "odd number of hex digits"; return false; }
+    for(size_t i=0;i<hex.size();i+=2) out.push_back((char)std::stoi(hex.substr(i,2), nullptr, 16));
+    return true;
+}
+
+static inline unsigned char fold_ascii(unsigned char c){
+    return (c>='A' && c<='Z')? (unsigned char)(c|0x20) : c;
+}
+
+#if defined(TEDIT_SSE2)
+static inline __m128i fold_ascii16(__m128i x){
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A'-1)), _mm_cmplt_epi8(x, _mm_set1_epi8('Z'+1)));
+    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+static bool equal_folded(const unsigned char* a, const unsigned char* folded, size_t m){
+    for(size_t k=0;k<m;++k) if(fold_ascii(a[k]) != folded[k]) return false;
+    return true;
+}
+
+// Same first/last-byte filter as find_bytes, with ASCII case folding done
+// on the loaded vectors; `pat` must already be folded.
+static const unsigned char* find_bytes_icase(const unsigned char* h, size_t n, const unsigned char* pat, size_t m){
+    if(m == 0) return h;
+    if(m > n) return nullptr;
+    size_t i = 0;
+#if defined(TEDIT_SSE2)
+    const __m128i first = _mm_set1_epi8((char)pat[0]);
+    const __m128i last  = _mm_set1_epi8((char)pat[m-1]);
+    for(; i + m - 1 + 16 <= n; i += 16){
+        __m128i a = fold_ascii16(_mm_loadu_si128((const __m128i*)(h+i)));
+        __m128i b = fold_ascii16(_mm_loadu_si128((const __m128i*)(h+i+m-1)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while(mask){
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if(m <= 2 || equal_folded(h+i+bit+1, pat+1, m-2)) return h+i+bit;
+            mask &= mask-1;
+        }
+    }
+#endif
+    for(; i + m <= n; ++i){
+        if(fold_ascii(h[i])==pat[0] && fold_ascii(h[i+m-1])==pat[m-1] && equal_folded(h+i+1, pat+1, m>=2? m-2 : 0)) return h+i;
+    }
+    return nullptr;
+}
+
+struct LiteralMatcher{
+    string pat;
+    bool icase = false;
+
+    LiteralMatcher(const string& q, bool ic): pat(q), icase(ic) {
+        if(icase) for(char& c: pat) c = (char)fold_ascii((unsigned char)c);
+    }
+
+    const char* find(const char* s, size_t n) const {
+        const unsigned char* h = (const unsigned char*)s;
+        const unsigned char* p = (const unsigned char*)pat.data();
+        const unsigned char* r = icase? find_bytes_icase(h, n, p, pat.size()) : find_bytes(h, n, p, pat.size());
+        return (const char*)r;
+    }
+    bool matches(const string& s) const { return find(s.data(), s.size()) != nullptr; }
+};
@@ -1,5 +1,7 @@
 struct Editor{
     Buffer buf; Stack undo, redo; LineReader lr;
+    StdinIngest ingest;
+    HexView hex;
 
     Theme theme = Theme::Default;
     ThemePalette P = palette_for(theme);
@@ -9,6 +11,14 @@ struct Editor{
 
     vector<Buffer> others;
     string last_search; bool last_icase=false; size_t last_index=0;
+    LineTest last_test; string last_need;   // set when last_search is a findf
+    MatchIndex matches;
+    HlMarks hl_marks;
+    HitList all_hits;
+    LiveSearch live;
+    std::map<string, LineSet> line_sets;
+    IdleWorker indexer;
+    long autoindex_mb = 64;
     int autosave_sec = 120;
     std::chrono::steady_clock::time_point last_autosave = std::chrono::steady_clock::now();
     std::map<string,string> aliases;
@@ -34,13 +44,19 @@ struct Editor{
             "repl","replg","read","undo","u","redo","set","filter","ls","pwd","number",
             "goto","n","N","new","bnext","bprev","lsb","buffer","close","theme","highlight","alias","diff",
             "cd","clear","version","lua","luafile","run-plugin","plugins","reload-plugins",
-            "lua-themes","config","recent","messages","syntax","plugin","w!","q!","quit!","write!"
+            "lua-themes","config","recent","messages","syntax","plugin","w!","q!","quit!","write!",
+            "bench","hex","session","stats","index","findall","findreall","jump","grep","findml","sel","findf","fuzzy"
         };
         lr.set_theme_colors(P);
+        lr.live_search = [this](const string& q, const std::function<bool()>& stop, vector<string>& rows){
+            return live_search(q, stop, rows);
+        };
         init_lua();
+        indexer.start([this]{ return index_slice(); });
     }
 
     ~Editor(){
+        indexer.stop();
         close_lua();
     }
 
@@ -140,6 +156,29 @@ struct Editor{
         cout<<"  wrap="<<onoff(wrap_long)<<"\n";
         cout<<"  truncate="<<onoff(truncate_long)<<"\n";
         cout<<"  lang="<<lang_name()<<"\n";
+        cout<<"  encoding="<<encoding_name(buf.enc, buf.bom)<<"\n";
+        cout<<"  threads="<<threads_name()<<"\n";
+        cout<<"  autoindex="<<(autoindex_mb>0? std::to_string(autoindex_mb) : string("off"))<<"\n";
+    }
+
+    void show_stats(){
+        RegexCache& rc = regex_cache();
+        uint64_t total = rc.hits + rc.misses;
+        cout<<"regex cache: "<<rc.size()<<"/"<<rc.capacity<<" patterns, "
+            <<rc.hits<<" hits, "<<rc.misses<<" misses, "<<rc.evictions<<" evictions";
+        if(total) cout<<" ("<<std::fixed<<std::setprecision(1)<<100.0*(double)rc.hits/(double)total<<"% hit rate)"<<std::defaultfloat;
+        cout<<"\n";
+        HlCache& hc = hl_cache();
+        total = hc.hits + hc.misses;
+        cout<<"highlight cache: "<<hc.size()<<"/"<<hc.capacity<<" lines, "<<human_bytes(hc.memory())<<", "
+            <<hc.hits<<" hits, "<<hc.misses<<" misses, "<<hc.evictions<<" evictions";
+        if(total) cout<<" ("<<std::fixed<<std::setprecision(1)<<100.0*(double)hc.hits/(double)total<<"% hit rate)"<<std::defaultfloat;
+        cout<<"\n";
+    }
+
+    static string threads_name(){
+        size_t n = WorkerPool::get().limit;
+        return n ? std::to_string(n) : "auto (" + std::to_string(WorkerPool::hardware()) + ")";
     }
 
     string lang_name() const {
@@ -152,14 +191,17 @@ struct Editor{
             case Lang::HTML: return "html";
             case Lang::CSS: return "css";
             case Lang::JSON: return "json";
-            default: return "plain";
+            default: break;
         }
+        if(const Grammar* g = grammars().get(lang)) return g->name;
+        return "plain";
     }
 
     void show_config_paths(){
         cout<<"config: "<<tedit_config_dir()<<"\n";
         cout<<"plugins: "<<tedit_plugins_dir()<<"\n";
         cout<<"themes: "<<tedit_themes_dir()<<"\n";
+        cout<<"grammars: "<<tedit_grammars_dir()<<"\n";
         cout<<"recovery: "<<tedit_recovery_dir()<<"\n";
         cout<<"rc: "<<cfg_path()<<"\n";
     }
@@ -186,7 +228,7 @@ struct Editor{
         static const HelpEntry entries[] = {
             {"help h ?", "help [command]", "Shows the full command list, or detailed help for one command. Command names and common aliases both work."},
             {"open", "open <path>", "Loads a file into the current buffer. Paths support ~ expansion. If the current buffer has unsaved changes, save or quit first."},
-            {"info", "info", "Shows current file path, dirty state, line count, character count, on-disk size, and file mode when available."},
+            {"info", "info", "Shows current file path, dirty state, line count, character count, on-disk size, file mode when available, and the detected encoding."},
             {"w write", "write [path] | write <range> <path>", "Saves the current buffer. With a path, saves there and adopts that path. With a range and path, writes only selected lines without changing the current buffer path."},
             {"w! write!", "write! [path]", "Force-saves the current buffer without creating a backup file for that save. Useful when backup files are unwanted for one write."},
             {"wq", "wq", "Saves the current buffer to its current path, then exits if the save succeeds."},
@@ -201,23 +243,29 @@ struct Editor{
             {"d delete", "delete [range]", "Deletes a range of lines and records the change for undo."},
             {"m move", "move <from> <to>", "Moves one line to a new zero-based insertion position and records the change for undo."},
             {"join", "join <range>", "Joins all lines in a range into one line separated by spaces."},
+            {"/", "/text  (or Ctrl-S)", "Literal, case-sensitive search. At a terminal the prompt turns incremental on '/' or Ctrl-S: the match count and first hits are redrawn on every key, and a scan still running when the next key arrives is abandoned. Enter prints every hit like find; Esc or Ctrl-G cancels."},
+            {"findf", "findf [-d <char>] <field|key> <op> <value>", "Searches structured log lines by field. A number picks that field (1-based; fields are split on runs of spaces and tabs, or on every -d character, e.g. -d , or -d tab); a name picks the value of name=value (quotes stripped). Operators: = and != (numeric when both sides are numbers), < <= > >= (numeric), ~ and !~ (substring). Lines without the field never match. The hits become the current search for n and N."},
+            {"fuzzy", "fuzzy [-n <count>] <query>", "Ranks lines that contain the query's characters in order, not necessarily adjacent, and prints the best 20 (or count) with their scores, matched characters highlighted. Matching ignores case unless the query has capitals. Runs of adjacent characters and word starts score higher. 'jump <k>' goes to the k-th result."},
             {"find", "find <text>", "Searches for literal text, case-sensitive, and prints every matching line."},
             {"findi", "findi <text>", "Searches for literal text, case-insensitive, and prints every matching line."},
-            {"findre", "findre [-i] <regex>", "Searches with a regular expression. Use -i for case-insensitive regex matching."},
+            {"findre", "findre [-i] <regex>", "Searches with a regular expression (ECMAScript syntax without lookaround or backreferences; runs in linear time). Use -i for case-insensitive regex matching."},
             {"findrei", "findrei <regex>", "Shortcut for case-insensitive regular expression search."},
             {"n", "n", "Repeats the previous plain find/findi search and jumps to the next match."},
             {"N", "N", "Repeats the previous plain find/findi search and jumps to the previous match."},
             {"goto", "goto <n>", "Prints line n so you can quickly jump to a location in the file."},
-            {"repl", "repl <old> <new>", "Replaces the first occurrence of old with new on each line."},
-            {"replg", "replg <old> <new>", "Replaces every occurrence of old with new on each line."},
+            {"sel", "sel [<name> <source>] | sel drop <name> | sel clear", "Named line sets, stored as compressed bitmaps. The source is find, findi, findre or findrei plus a pattern, or an expression of @sets and ranges joined by | (union), & (intersection) and - (difference), evaluated left to right: sel hot @err - @retry & 1000-50000. p @name, d @name and write @name <path> use a set as their target. Sets keep the line numbers they were built with; later edits do not move them. Without arguments, lists every set with its size."},
+            {"g v", "[range]g/regex/[cmd]  |  [range]v/regex/[cmd]", "Collects every line in the range (default: whole buffer) that matches the regex (v: does not match) in one scan, then applies cmd to all of them as one undo step. cmd is p (default, print), d (delete), s/re/rep/[gin] (substitute on those lines) or lua <function>, which is called as function(line, text) and may return a replacement string."},
+            {"s", "[range]s/regex/replacement/[g][i][n]", "Regex substitution over a range (default: whole buffer) as a single undo step. g replaces every match on a line instead of the first, i ignores case, n only counts matches. The replacement may use $1 or \\1 for groups and $& for the whole match, \\t for a tab and \\\\ for a backslash; other letter escapes such as \\n are an error, as substitution never splits a line. Any punctuation can replace '/'."},
+            {"repl", "repl [range] <old> <new>", "Replaces the first occurrence of old with new on each line of the range (default: whole buffer). Only rewritten lines are stored for undo."},
+            {"replg", "replg [range] <old> <new>", "Replaces every occurrence of old with new on each line of the range (default: whole buffer). Only rewritten lines are stored for undo."},
             {"read", "read <path> [n]", "Reads another file and inserts it after line n. If n is omitted, inserts at the end. Paths support ~ expansion."},
             {"filter", "filter <range> !shell", "Runs a shell command with the selected range on stdin and replaces that range with command output."},
-            {"undo u", "undo [count]", "Reverts the most recent edit, or count edits. Undo stores line snapshots."},
+            {"undo u", "undo [count]", "Reverts the most recent edit, or count edits. Undo stores line snapshots. The history is shared by all buffers; a step made in another buffer is refused until you switch to it, and closing a buffer drops its steps."},
             {"redo", "redo", "Reapplies one change that was undone."},
-            {"set", "set [name value]", "Without arguments, lists settings. Supports number, backup, autosave, wrap, truncate, and lang."},
+            {"set", "set [name value]", "Without arguments, lists settings. Supports number, backup, autosave, wrap, truncate, lang, encoding, threads (worker count for searches over large buffers; auto uses every core), and autoindex (buffers of at least this many MB get a trigram index on open; off disables)."},
             {"number", "number", "Toggles line numbers and saves the setting."},
-            {"highlight", "highlight on|off", "Turns syntax highlighting on or off for the active buffer and saves the setting."},
-            {"syntax", "syntax <name>", "Alias for set lang <name>. Useful values include cpp, python, shell, ruby, js, html, css, json, and plain."},
+            {"highlight", "highlight on|off", "Turns syntax highlighting on or off for the active buffer and saves the setting. Block comments (C/C++, JS, CSS, HTML), Python triple-quoted strings and JS template strings carry across lines; the lexer state is checkpointed every 256 lines, so printing deep into a file lexes from the nearest checkpoint rather than the top."},
+            {"syntax", "syntax <name>", "Alias for set lang <name>. Useful values include cpp, python, shell, ruby, js, html, css, json, plain, and the name of any grammar loaded from ~/tedit-config/grammars."},
             {"theme", "theme <name> | theme preview", "Applies a built-in or Lua theme. theme preview prints samples for built-in themes."},
             {"alias", "alias <from> <to...>", "Creates a command alias stored in config. The alias replaces the first command word before dispatch."},
             {"new", "new [path]", "Pushes the current buffer into the buffer list and opens a new empty or file-backed buffer."},
@@ -239,9 +287,18 @@ struct Editor{
             {"luafile", "luafile <path>", "Runs a Lua script file. Paths support ~ expansion. Script code is trusted code."},
             {"run-plugin", ":run-plugin <name|path>", "Runs a Lua plugin by configured plugin name or file path. The leading colon is required for safety."},
             {"plugin", "plugin trust|untrust|trusted [name|path]", "Manages trusted plugin warning sources. Trusting suppresses heuristic warnings for that plugin path or name."},
-            {"plugins", "plugins", "Lists Lua plugin files found under ~/tedit-config/plugins and marks the current plugin when applicable."},
-            {"reload-plugins", "reload-plugins", "Rescans ~/tedit-config/plugins for Lua plugin files without restarting tedit."},
-            {"lua-themes", "lua-themes", "Lists Lua theme files found under ~/tedit-config/themes and marks the active Lua theme."}
+            {"plugins", "plugins", "Lists Lua plugin files found under ~/tedit-config/plugins and marks the current plugin when applicable, followed by the loaded syntax grammars and their extensions."},
+            {"reload-plugins", "reload-plugins", "Rescans ~/tedit-config/plugins for Lua plugin files and recompiles the grammars in ~/tedit-config/grammars without restarting tedit. Grammars a plugin registered with tedit_grammar are kept."},
+            {"lua-themes", "lua-themes", "Lists Lua theme files found under ~/tedit-config/themes and marks the active Lua theme."},
+            {"hex", "hex <path> | hex print|find|next|set|write|close|info ...", "Maps a file read-only and shows offset, hex and ASCII columns for a range only, so large binaries open instantly. hex print [offset] [len] pages from the last position; hex find <hex bytes|\"text\"> and hex next search the mapping; hex set <offset> <hex bytes> patches bytes in memory; hex write [path] saves through the normal atomic save path; hex close! drops unsaved patches. Offsets accept decimal or 0x hex."},
+            {"session", "session save|load|list|delete [name]", "Saves every buffer with its path, contents, settings and encoding, plus undo/redo history, search state and aliases into ~/tedit-config/sessions/<name>.tsess. session load (or tedit --session <name>) maps the file back; clean buffers whose files are unchanged on disk are restored from the snapshot without re-reading the source."},
+            {"bench", "bench encoding|search|regex|subst|highlight [mb]", "Runs a built-in throughput benchmark on synthetic data (default 64 MB). encoding measures UTF-8/UTF-16/Latin-1 transcoding; search compares the literal matcher with the old copy-and-find scan (use 1024 for a 1 GB buffer); regex compares the built-in engine with std::regex; subst compares s/// with piping the lines through sed; highlight measures the syntax lexers per language (use a small size such as 8)."},
+            {"findml", "findml [range] [-i] <regex>", "Regex search across line breaks: the buffer (or range) is matched as one text joined by newlines, without copying it. \\n and \\s match line breaks, '.' does not, and ^/$ match at every line start/end. Prints the first and last line of each match."},
+            {"findall findreall", "findall|findreall [-i] <pattern>", "Searches every open buffer at once (literal text or regex; -i ignores case) and prints numbered buffer:line: text hits grouped by buffer."},
+            {"jump", "jump [k]", "Switches to the buffer of findall/findreall/grep hit k (opening the file if needed) and shows that line; n/N then continue from it. Without k, goes to the next hit."},
+            {"grep", "grep [-i] [-E] [-a] <pattern> [dir]", "Searches every text file under dir (default .) on the worker pool and prints numbered path:line: text hits as each file finishes. -i ignores case, -E treats the pattern as a regex, -a includes hidden files. Binary files, .git/.hg/.svn/node_modules and paths listed in .gitignore or .teditignore are skipped. Quote patterns that contain spaces."},
+            {"index", "index [on|off|status|save]", "Builds a trigram index of the current buffer in the background while tedit waits at the prompt. find, findi and findre patterns that start with three or more literal characters then scan only the line blocks that can match. Edits mark their blocks for re-indexing and stay searchable meanwhile. index status shows progress and memory use; index save stores the index in the recovery directory, and index on reuses it while the file is unchanged on disk."},
+            {"stats", "stats [reset]", "Shows internal counters: size, hits, misses and evictions of the compiled-pattern cache and of the highlight cache (lexed lines, with its memory use). stats reset zeroes them and empties both caches."}
         };
         for(const auto& e: entries){
             std::istringstream names(e.names);
@@ -267,7 +324,9 @@ struct Editor{
         lua_register(L, "tedit_command", l_tedit_command);
         lua_register(L, "tedit_echo",    l_tedit_echo);
         lua_register(L, "tedit_print",   l_tedit_print);
+        lua_register(L, "tedit_grammar", l_tedit_grammar);
         load_lua_plugins();
+        load_grammars();
     }
 
     void close_lua(){
@@ -297,6 +356,59 @@ struct Editor{
         }
     }
 
+    // Runs every *.lua file in the grammars directory and compiles the table
+    // it returns to native tables, once, here. Grammar files are data, not
+    // plugins: each runs in its own state with only the base, string and
+    // table libraries (no io/os, no file loaders, no tedit_* functions).
+    void load_grammars(){
+        grammars().clear_files();
+        string dir = tedit_grammars_dir();
+        std::error_code ec;
+        vector<fs::path> files;
+        if(fs::is_directory(dir, ec)){
+            fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+            for(; !ec && it!=end; it.increment(ec))
+                if(it->is_regular_file() && it->path().extension()==".lua") files.push_back(it->path());
+        }
+        std::sort(files.begin(), files.end());
+        for(auto& p: files){
+            lua_State* GL = luaL_newstate();
+            if(!GL){
+                cout<<P.err<<"grammar: failed to initialize lua state"<<C_RESET<<"\n";
+                break;
+            }
+            luaL_requiref(GL, "_G", luaopen_base, 1);
+            luaL_requiref(GL, LUA_STRLIBNAME, luaopen_string, 1);
+            luaL_requiref(GL, LUA_TABLIBNAME, luaopen_table, 1);
+            lua_settop(GL, 0);
+            for(const char* name: {"dofile", "loadfile"}){
+                lua_pushnil(GL);
+                lua_setglobal(GL, name);
+            }
+            if(luaL_loadfile(GL, p.string().c_str()) != LUA_OK || lua_pcall(GL, 0, 1, 0) != LUA_OK){
+                const char* msg = lua_tostring(GL, -1);
+                cout<<P.err<<"grammar: "<<(msg?msg:"")<<C_RESET<<"\n";
+            } else if(lua_istable(GL, -1)){
+                std::unique_ptr<Grammar> g(new Grammar);
+                g->from_file = true;
+                string err;
+                if(!grammar_from_lua(GL, -1, *g, err) || !grammars().add(std::move(g), err))
+                    cout<<P.err<<"grammar: "<<p.filename().string()<<": "<<err<<C_RESET<<"\n";
+            } else {
+                cout<<P.err<<"grammar: "<<p.filename().string()<<": must return a table"<<C_RESET<<"\n";
+            }
+            lua_close(GL);
+        }
+        grammars_changed();
+    }
+
+    // Cached spans and checkpoints may come from a grammar that changed.
+    void grammars_changed(){
+        hl_cache().clear();
+        hl_marks.reset();
+        if(lang == Lang::Plain || ((int)lang >= LANG_BUILTIN && !grammars().get(lang))) lang = detect_lang(buf.path);
+    }
+
     static bool scan_plugin_text(const string& content, vector<string>& hits){
         static const char* patterns[] = {
             "os.execute", "io.popen", "dofile", "loadfile",
@@ -409,6 +521,8 @@ struct Editor{
         out<<"autosave="<<(autosave_sec)<<"\n";
         out<<"wrap="<<(wrap_long?"on":"off")<<"\n";
         out<<"truncate="<<(truncate_long?"on":"off")<<"\n";
+        out<<"threads="<<WorkerPool::get().limit<<"\n";
+        out<<"autoindex="<<autoindex_mb<<"\n";
         for(auto& kv: aliases) out<<"alias\t"<<esc(kv.first)<<"\t"<<esc(kv.second)<<"\n";
         for(auto& p: recent_files) out<<"recent\t"<<esc(p)<<"\n";
         for(auto& p: trusted_plugins) out<<"trust\t"<<esc(p)<<"\n";
@@ -469,6 +583,8 @@ struct Editor{
             else if(key=="autosave"){ long s; if(parse_long(val,s)) autosave_sec=(int)std::max<long>(0,s); }
             else if(key=="wrap"){ bool b; if(parse_bool_string(val,b)) wrap_long=b; }
             else if(key=="truncate"){ bool b; if(parse_bool_string(val,b)) truncate_long=b; }
+            else if(key=="threads"){ long n; if(parse_long(val,n)) WorkerPool::get().limit=(size_t)std::max<long>(0,n); }
+            else if(key=="autoindex"){ long n; if(parse_long(val,n)) autoindex_mb=std::max<long>(0,n); }
         }
     }
 
@@ -506,17 +622,24 @@ struct Editor{
     }
 
     void status(){
+        pump_stdin();
+        string feed;
+        if(ingest.active()){
+            feed = " | " + ingest.progress();
+            if(!streaming_buffer()) ingest.reset();
+        }
         using std::chrono::system_clock;
         auto t = system_clock::to_time_t(system_clock::now());
         char tb[32]; strftime(tb,sizeof(tb),"%H:%M:%S", localtime(&t));
         string tname = theme_name(theme);
-        cout<<P.dim<<"["<<current_buffer_index()<<"/"<<(buffer_count()-1)<<" "<< (buf.path.empty()? "(unnamed)": buf.path) << "] "
+        cout<<P.dim<<"["<<current_buffer_index()<<"/"<<(buffer_count()-1)<<" "<< (buf.streaming? "(stdin)": buf.path.empty()? "(unnamed)": buf.path) << "] "
         <<"lines="<<buf.lines.size()<<" chars="<<char_count(buf)
         <<(buf.dirty?" *":"")
         <<" | "<<tb<<" | theme:"<<tname
         <<" | hl:"<<(buf.highlight?"on":"off")
         <<" | wrap:"<<(wrap_long?"on":"off")
         <<" | plugin:"<<(current_plugin.empty() ? "none" : current_plugin)
+        <<feed
         <<C_RESET<<"\n";
     }
 
@@ -549,10 +672,19 @@ struct Editor{
         CMD("d|delete [range]",       "", "delete lines");
         CMD("m|move <from> <to>",     "", "move line");
         CMD("join <range>",           "", "join lines with space");
-        CMD("/text | find | findi | findre", "", "search (regex via findre)");
+        CMD("/text | find | findi | findre", "", "search (regex via findre); / or Ctrl-S is live");
+        CMD("findf <field|key> <op> <v>", "", "field search: = != < <= > >= ~ !~");
+        CMD("fuzzy [-n k] <query>",   "", "ranked fuzzy line finder (jump <k>)");
+        CMD("findml [range] <regex>",  "", "regex search spanning lines");
+        CMD("findall | findreall [-i]", "", "search every open buffer");
+        CMD("grep [-i] [-E] <pat> [dir]", "", "search files under dir in parallel");
+        CMD("jump [k]",               "", "go to findall/grep hit k (buffer + line)");
         CMD("n | N",                  "", "next/prev match from last search");
         CMD("goto <n>",               "", "jump to line");
-        CMD("repl old new | replg old new", "", "replace first/global per line");
+        CMD("repl|replg [range] old new", "", "replace first/global per line");
+        CMD("[range]s/re/rep/[gin]",  "", "regex substitute ($1 or \\1 captures)");
+        CMD("sel <name> <source>",    "", "named line sets: find/findre, @set | & - range");
+        CMD("[range]g/re/cmd | v/re/cmd", "", "p, d, s/// or lua <fn> on (non-)matching lines");
         CMD("read <path> [n]",        "", "insert file after n (default=end)");
         CMD("filter <range> !shell",  "", "pipe range through shell and replace (safe temp names)");
         CMD("undo | u [k]",           "", "undo (optionally k steps)");
@@ -564,6 +696,7 @@ struct Editor{
         CMD("set wrap on|off",        "", "soft-wrap long lines under the gutter");
         CMD("set truncate on|off",    "", "truncate line display when wrap=off");
         CMD("set lang <name>",        "", "override syntax (auto by extension)");
+        CMD("set encoding <name>",    "", "utf8|utf8-bom|utf16le|utf16be|latin1 for the next save");
         CMD("highlight on|off",       "", "simple syntax highlighting");
         CMD("syntax <name>",          "", "alias for set lang <name>");
         CMD("theme <name>",           "", "default|dark|neon|matrix|paper|yellow|iceberg or lua theme");
@@ -586,17 +719,340 @@ struct Editor{
         CMD("reload-plugins",         "", "rescan Lua plugins from tedit-config/plugins");
         
         CMD("lua-themes",             "", "list available Lua themes");
+        CMD("hex <path>",             "", "mmap hex view (hex print|find|next|set|write|close)");
+        CMD("session save|load <name>", "", "snapshot or restore all buffers, undo and settings");
+        CMD("session list|delete",    "", "list or remove saved sessions");
+        CMD("index on|off|status|save", "", "trigram index for fast repeated searches");
+        CMD("stats [reset]",          "", "regex and highlight cache counters");
+        CMD("bench <what> [mb]",      "", "throughput benchmarks (encoding, search, regex, subst, highlight)");
         cout<<P.dim<<"Tab: first word => commands only; after 'cd ' => directories only."<<C_RESET<<"\n";
     }
 
     void load(const string& p){
         string path = expand_path(p);
+        drop_history();
+        buf.id = next_buffer_id();
         buf.path=path; load_file(path, buf);
         lang = detect_lang(path);
         add_recent(path);
         note("opened " + path);
         cout<<P.ok<<"opened "<<path<<C_RESET<<"\n";
+        if(looks_binary_file(path)) cout<<P.warn<<"binary file; 'hex "<<path<<"' views it without splitting into lines"<<C_RESET<<"\n";
         (void)maybe_recover(buf);
+        buffer_replaced();
+        buf.tri.reset();
+        maybe_autoindex(buf);
+    }
+
+    bool any_dirty() const {
+        if(buf.dirty) return true;
+        for(const auto& b: others) if(b.dirty) return true;
+        return false;
+    }
+
+    static uint64_t buffer_flags(const Buffer& b){
+        return (b.dirty?1u:0u) | (b.number?2u:0u) | (b.backup?4u:0u) | (b.highlight?8u:0u) | (b.bom?16u:0u);
+    }
+
+    bool session_save(const string& name){
+        if(!valid_session_name(name)){ cout<<P.warn<<"session: names use letters, digits, '-', '_' and '.'"<<C_RESET<<"\n"; return false; }
+        pump_stdin();
+        string path = session_path(name), err;
+        auto write_buffer = [](SessWriter& w, const Buffer& b){
+            FileStamp fst; bool have = file_stamp(b.path, fst);
+            w.str(b.path);
+            w.u64(buffer_flags(b));
+            w.u64((uint64_t)b.enc);
+            w.u64(have? 1 : 0);
+            w.u64((uint64_t)fst.sec); w.u64((uint64_t)fst.nsec); w.u64(fst.size);
+            w.lines(b.lines);
+        };
+        bool ok = atomic_save_with(path, false, [&](FILE* tf, string& e){
+            SessWriter w(tf);
+            w.raw(SESSION_MAGIC, sizeof(SESSION_MAGIC));
+            w.u64(SESSION_VERSION);
+            w.u64(SESS_META);
+            w.str(last_test? string() : last_search); w.u64(last_icase); w.u64(last_index);
+            w.u64((uint64_t)lang); w.u64(wrap_long); w.u64(truncate_long);
+            w.u64(SESS_ALIASES); w.u64(aliases.size());
+            for(auto& kv: aliases){ w.str(kv.first); w.str(kv.second); }
+            w.u64(SESS_BUFFERS); w.u64(buffer_count());
+            write_buffer(w, buf);
+            for(const auto& b: others) write_buffer(w, b);
+            // Steps name their buffer by its position in SESS_BUFFERS.
+            auto owner = [&](uint64_t id){
+                if(id == buf.id) return (uint64_t)0;
+                for(size_t i=0;i<others.size();++i) if(others[i].id == id) return (uint64_t)i+1;
+                return (uint64_t)buffer_count();
+            };
+            w.u64(SESS_UNDO); w.u64(undo.st.size());
+            auto write_snap = [&](const Snap& s){
+                w.u64(owner(s.buf_id)); w.u64(s.kind); w.lines(s.lines);
+                if(s.kind == Snap::Changed){ w.u64(s.at.size()); for(size_t i: s.at) w.u64(i); }
+            };
+            for(const auto& s: undo.st) write_snap(s);
+            w.u64(SESS_REDO); w.u64(redo.st.size());
+            for(const auto& s: redo.st) write_snap(s);
+            w.u64(SESS_END);
+            if(!w.ok){ e = string("write: ") + strerror(errno); fclose(tf); return false; }
+            return finish_tmp_file(tf, e);
+        }, err, 0600);
+        if(!ok){ cout<<P.err<<"session: "<<err<<C_RESET<<"\n"; return false; }
+        note("session saved " + name);
+        cout<<P.ok<<"session: saved "<<buffer_count()<<" buffer(s) to "<<path<<C_RESET<<"\n";
+        return true;
+    }
+
+    bool session_restore(const string& name){
+        if(!valid_session_name(name)){ cout<<P.warn<<"session: bad name"<<C_RESET<<"\n"; return false; }
+        string path = session_path(name), err;
+        if(!file_exists(path)){ cout<<P.err<<"session: no such session: "<<name<<C_RESET<<"\n"; return false; }
+        MappedFile mf;
+        if(!mf.open(path, err)){ cout<<P.err<<"session: "<<err<<C_RESET<<"\n"; return false; }
+        SessReader r(mf.data, mf.size);
+        if(mf.size < 16 || std::memcmp(mf.data, SESSION_MAGIC, sizeof(SESSION_MAGIC))!=0){ cout<<P.err<<"session: not a tedit session file"<<C_RESET<<"\n"; return false; }
+        r.pos = sizeof(SESSION_MAGIC);
+        if(r.u64()!=SESSION_VERSION){ cout<<P.err<<"session: unsupported version"<<C_RESET<<"\n"; return false; }
+
+        string s_search; bool s_icase=false; size_t s_index=0; uint64_t s_lang=0; bool s_wrap=wrap_long, s_trunc=truncate_long;
+        std::map<string,string> s_aliases;
+        vector<Buffer> bufs;
+        Stack s_undo, s_redo;
+        size_t from_snapshot=0, reloaded=0, changed=0;
+        vector<bool> was_reloaded;
+
+        auto read_snaps = [&](Stack& stk){
+            uint64_t cnt = r.u64();
+            for(uint64_t i=0;i<cnt && r.ok;i++){
+                Snap sn;
+                sn.buf_id = r.u64();    // buffer position until the buffers exist
+                uint64_t kind = r.u64();
+                r.lines(sn.lines);
+                if(kind == Snap::Changed){
+                    uint64_t n = r.u64();
+                    if(n != sn.lines.size()){ r.ok = false; break; }
+                    sn.kind = Snap::Changed;
+                    for(uint64_t k=0;k<n && r.ok;k++){
+                        uint64_t at = r.u64();
+                        if(!sn.at.empty() && at <= sn.at.back()) r.ok = false;
+                        sn.at.push_back((size_t)at);
+                    }
+                } else if(kind != Snap::Full){ r.ok = false; break; }
+                stk.st.push_back(std::move(sn));
+            }
+        };
+
+        for(bool done=false; !done && r.ok;){
+            switch(r.u64()){
+                case SESS_META:
+                    s_search = r.str(); s_icase = r.u64()!=0; s_index = (size_t)r.u64();
+                    s_lang = r.u64(); s_wrap = r.u64()!=0; s_trunc = r.u64()!=0;
+                    break;
+                case SESS_ALIASES: {
+                    uint64_t cnt = r.u64();
+                    for(uint64_t i=0;i<cnt && r.ok;i++){ string k = r.str(); s_aliases[k] = r.str(); }
+                    break;
+                }
+                case SESS_BUFFERS: {
+                    uint64_t cnt = r.u64();
+                    for(uint64_t i=0;i<cnt && r.ok;i++){
+                        Buffer b;
+                        b.path = r.str();
+                        uint64_t fl = r.u64();
+                        b.dirty = fl&1; b.number = fl&2; b.backup = fl&4; b.highlight = fl&8; b.bom = fl&16;
+                        b.enc = (Encoding)r.u64();
+                        bool had = r.u64()!=0;
+                        FileStamp saved; saved.sec = (long long)r.u64(); saved.nsec = (long long)r.u64(); saved.size = r.u64();
+                        FileStamp now; bool have = file_stamp(b.path, now);
+                        bool same = had && have && now.sec==saved.sec && now.nsec==saved.nsec && now.size==saved.size;
+                        bool fresh = !b.path.empty() && have && !same && !b.dirty;
+                        if(fresh){
+                            vector<string> skip; r.lines(skip);
+                            load_file(b.path, b);
+                            reloaded++;
+                        } else {
+                            r.lines(b.lines);
+                            from_snapshot++;
+                            if(!b.path.empty() && had && !same){ changed++; b.dirty = true; }
+                        }
+                        was_reloaded.push_back(fresh);
+                        bufs.push_back(std::move(b));
+                    }
+                    break;
+                }
+                case SESS_UNDO: read_snaps(s_undo); break;
+                case SESS_REDO: read_snaps(s_redo); break;
+                case SESS_END: done = true; break;
+                default: r.ok = false; break;
+            }
+        }
+        if(!r.ok || bufs.empty()){ cout<<P.err<<"session: "<<path<<" is truncated or corrupt"<<C_RESET<<"\n"; return false; }
+        // Undo steps address lines of the snapshot text; after a reload from
+        // disk they would point at different lines, so those are dropped.
+        for(Stack* stk: {&s_undo, &s_redo}){
+            auto keep = std::remove_if(stk->st.begin(), stk->st.end(), [&](const Snap& sn){
+                return sn.buf_id >= bufs.size() || was_reloaded[(size_t)sn.buf_id];
+            });
+            stk->st.erase(keep, stk->st.end());
+            for(auto& sn: stk->st) sn.buf_id = bufs[(size_t)sn.buf_id].id;
+        }
+        for(auto& b: bufs) if(!snaps_fit(s_undo, b) || !snaps_fit(s_redo, b)){
+            cout<<P.err<<"session: "<<path<<" has undo history that does not match its text"<<C_RESET<<"\n"; return false;
+        }
+
+        buf = std::move(bufs.front());
+        others.assign(std::make_move_iterator(bufs.begin()+1), std::make_move_iterator(bufs.end()));
+        undo = std::move(s_undo); redo = std::move(s_redo);
+        last_search = s_search; last_icase = s_icase; last_index = s_index; last_test = nullptr;
+        aliases = s_aliases;
+        wrap_long = s_wrap; truncate_long = s_trunc;
+        lang = s_lang <= (uint64_t)Lang::JSON ? (Lang)s_lang : detect_lang(buf.path);
+        kick_index();
+        note("session restored " + name);
+        cout<<P.ok<<"session: restored "<<buffer_count()<<" buffer(s) ("<<from_snapshot<<" from snapshot, "<<reloaded<<" reloaded from disk)"<<C_RESET<<"\n";
+        if(changed) cout<<P.warn<<"session: "<<changed<<" modified buffer(s) changed on disk since the snapshot; kept the snapshot text"<<C_RESET<<"\n";
+        return true;
+    }
+
+    void session_command(const string& rest){
+        std::istringstream ts(rest); string sub, name; ts>>sub>>name;
+        sub = lower(sub);
+        if(sub=="save"){
+            if(name.empty()){ cout<<P.warn<<"usage: session save <name>"<<C_RESET<<"\n"; return; }
+            session_save(name); return;
+        }
+        if(sub=="load"||sub=="restore"){
+            if(name.empty()){ cout<<P.warn<<"usage: session load <name>"<<C_RESET<<"\n"; return; }
+            if(any_dirty()){ cout<<P.warn<<"session: unsaved changes; save or close buffers first"<<C_RESET<<"\n"; return; }
+            session_restore(name); return;
+        }
+        if(sub=="delete"||sub=="rm"){
+            if(!valid_session_name(name)){ cout<<P.warn<<"usage: session delete <name>"<<C_RESET<<"\n"; return; }
+            if(::unlink(session_path(name).c_str())==0) cout<<"session: deleted "<<name<<"\n";
+            else cout<<P.err<<"session: "<<name<<": "<<std::strerror(errno)<<C_RESET<<"\n";
+            return;
+        }
+        if(sub=="list"||sub.empty()){
+            vector<std::pair<string,uintmax_t>> found;
+            std::error_code ec;
+            for(auto& e: fs::directory_iterator(tedit_sessions_dir(), fs::directory_options::skip_permission_denied, ec)){
+                if(e.path().extension()==".tsess") found.emplace_back(e.path().stem().string(), e.file_size(ec));
+            }
+            std::sort(found.begin(), found.end());
+            if(found.empty()){ cout<<"no sessions\n"; return; }
+            for(auto& f: found) cout<<"- "<<f.first<<" ("<<human_bytes((size_t)f.second)<<")\n";
+            return;
+        }
+        cout<<P.warn<<"usage: session save|load|list|delete [name]"<<C_RESET<<"\n";
+    }
+
+    void hex_command(const string& rest){
+        std::istringstream ts(rest); string sub; ts>>sub;
+        string arg; std::getline(ts, arg); arg = trim_copy(arg);
+        string ls = lower(sub);
+        static const char* subs[] = {"open","print","p","find","next","set","write","w","close","close!","info"};
+        bool known = std::find_if(std::begin(subs), std::end(subs), [&](const char* k){ return ls==k; }) != std::end(subs);
+        if(sub.empty()){
+            if(!hex.active()){ cout<<P.warn<<"usage: hex <path>"<<C_RESET<<"\n"; return; }
+            ls = "print";
+        } else if(!known || ls=="open"){
+            string p = expand_path(ls=="open"? arg : rest);
+            if(p.empty()){ cout<<P.warn<<"usage: hex open <path>"<<C_RESET<<"\n"; return; }
+            if(hex.dirty()){ cout<<P.warn<<"hex: unsaved patches in "<<hex.path<<" (hex write or hex close!)"<<C_RESET<<"\n"; return; }
+            string err;
+            if(!hex.open(p, err)){ cout<<P.err<<"hex: "<<p<<": "<<err<<C_RESET<<"\n"; return; }
+            note("hex " + p);
+            cout<<P.ok<<"hex: "<<p<<" ("<<human_bytes(hex.size)<<")"<<C_RESET<<"\n";
+            hex.dump(0, 256, P);
+            hex.cursor = std::min(hex.size, (size_t)256);
+            return;
+        }
+        if(!hex.active()){ cout<<P.warn<<"hex: no file (use: hex <path>)"<<C_RESET<<"\n"; return; }
+
+        if(ls=="print"||ls=="p"){
+            std::istringstream as(arg); string o, l; as>>o>>l;
+            size_t off = hex.cursor, len = 256;
+            if(!o.empty() && !parse_offset(o, off)){ cout<<P.warn<<"usage: hex print [offset] [len]"<<C_RESET<<"\n"; return; }
+            if(!l.empty() && (!parse_offset(l, len) || len==0)){ cout<<P.warn<<"usage: hex print [offset] [len]"<<C_RESET<<"\n"; return; }
+            hex.dump(off, len, P);
+            hex.cursor = std::min(hex.size, off + len);
+            return;
+        }
+        if(ls=="find"||ls=="next"){
+            string pat, err;
+            if(ls=="find"){
+                if(!parse_byte_pattern(arg, pat, err)){ cout<<P.warn<<"hex find: "<<err<<C_RESET<<"\n"; return; }
+                hex.last_pattern = pat;
+            } else {
+                if(hex.last_pattern.empty()){ cout<<"(no previous hex search)\n"; return; }
+                pat = hex.last_pattern;
+            }
+            size_t from = (ls=="find")? 0 : hex.cursor;
+            size_t at = hex.find(pat, from);
+            if(at==string::npos && ls=="next" && from>0) at = hex.find(pat, 0);
+            if(at==string::npos){ cout<<"no matches\n"; return; }
+            cout<<"match at 0x"<<std::hex<<at<<std::dec<<" ("<<at<<")\n";
+            hex.dump(at, pat.size(), P);
+            hex.cursor = at + 1;
+            return;
+        }
+        if(ls=="set"){
+            std::istringstream as(arg); string o; as>>o; string bytes; std::getline(as, bytes);
+            size_t off = 0; string pat, err;
+            if(!parse_offset(o, off) || !parse_byte_pattern(bytes, pat, err)){ cout<<P.warn<<"usage: hex set <offset> <hex bytes|\"text\">"<<C_RESET<<"\n"; return; }
+            if(!hex.patch(off, pat, err)){ cout<<P.err<<"hex set: "<<err<<C_RESET<<"\n"; return; }
+            hex.dump(off, pat.size(), P);
+            return;
+        }
+        if(ls=="write"||ls=="w"){
+            string target = arg.empty()? hex.path : expand_path(arg);
+            string err;
+            if(!hex.save(target, buf.backup, err)){ cout<<P.err<<"hex write: "<<err<<C_RESET<<"\n"; return; }
+            note("hex saved " + target);
+            cout<<P.ok<<"saved to "<<target<<C_RESET<<"\n";
+            return;
+        }
+        if(ls=="close"||ls=="close!"){
+            if(hex.dirty() && ls!="close!"){ cout<<P.warn<<"hex: unsaved patches (hex write or hex close!)"<<C_RESET<<"\n"; return; }
+            hex.close();
+            cout<<"hex: closed\n";
+            return;
+        }
+        cout<<"hex: "<<hex.path<<"\n  size: "<<hex.size<<" bytes ("<<human_bytes(hex.size)<<")\n  patched: "<<hex.patched<<" byte(s)\n";
+    }
+
+    void load_stdin(int fd){
+        drop_history();
+        buf = Buffer{};
+        buf.streaming = true;
+        lang = Lang::Plain;
+        ingest.start(fd);
+        note("reading stdin");
+        cout<<P.ok<<"reading stdin in the background"<<C_RESET<<"\n";
+    }
+
+    Buffer* streaming_buffer(){
+        if(buf.streaming) return &buf;
+        for(auto& b: others) if(b.streaming) return &b;
+        return nullptr;
+    }
+
+    void pump_stdin(){
+        if(!ingest.active()) return;
+        Buffer* t = streaming_buffer();
+        if(!t){
+            if(!ingest.finished()) ingest.reset();
+            return;
+        }
+        bool fin = ingest.finished();
+        size_t before = t->lines.size();
+        ingest.drain(t->lines);
+        if(t==&buf && t->lines.size()>before) lines_changed(before+1, 0, t->lines.size()-before);
+        if(!fin) return;
+        t->streaming = false;
+        string e = ingest.error();
+        if(!e.empty()) cout<<P.err<<"stdin: "<<e<<C_RESET<<"\n";
+        note(ingest.progress());
     }
 
     bool run_hook(const char* name){
@@ -636,6 +1092,113 @@ struct Editor{
 
     void push_undo(){ undo.push(buf); redo.clear(); }
 
+    // Moves the top step of `from` onto `to` as its inverse after applying
+    // it to buf. A step of another buffer is left in place; one that no
+    // longer fits buf drops buf's history. Either way nothing is changed.
+    bool restore_snap(Stack& from, Stack& to, const char* what){
+        Snap& s = from.st.back();
+        if(s.buf_id != buf.id){
+            string owner = "a closed buffer";
+            for(auto& b: others) if(b.id == s.buf_id) owner = buffer_label(b);
+            cout<<P.warn<<what<<": the next step belongs to "<<owner<<"; switch to it first"<<C_RESET<<"\n";
+            return false;
+        }
+        if(!apply_snap(s, buf)){
+            cout<<P.err<<what<<": step addresses lines this buffer no longer has; dropped its undo history"<<C_RESET<<"\n";
+            undo.drop(buf.id); redo.drop(buf.id);
+            return false;
+        }
+        buf.dirty = true;
+        if(s.kind == Snap::Full) buffer_replaced();
+        else {
+            vector<size_t> changed;
+            for(size_t i: s.at) changed.push_back(i+1);
+            lines_rewritten(changed);
+        }
+        Snap inv; from.pop(inv);
+        to.push(std::move(inv));
+        return true;
+    }
+
+    // buf is being closed or replaced by other text: its steps can never
+    // apply again.
+    void drop_history(){ undo.drop(buf.id); redo.drop(buf.id); }
+
+    // Every edit of the current buffer reports the 1-based span it replaced
+    // so cached search state can be patched instead of rebuilt.
+    void lines_changed(size_t lo, size_t old_n, size_t new_n){
+        matches.lines_changed(buf, lo, old_n, new_n);
+        hl_marks.invalidate_from(lo);
+        if(buf.tri){ buf.tri->lines_changed(lo, old_n, new_n); indexer.kick(); }
+    }
+    void lines_rewritten(const vector<size_t>& changed){
+        matches.lines_rewritten(buf, changed);
+        if(!changed.empty()) hl_marks.invalidate_from(*std::min_element(changed.begin(), changed.end()));
+        if(buf.tri){ buf.tri->lines_touched(changed); indexer.kick(); }
+    }
+    void buffer_replaced(){
+        matches.invalidate();
+        hl_marks.reset();
+        if(buf.tri){ buf.tri->reset(); indexer.kick(); }
+    }
+
+    // Runs on the indexer thread, only while the main thread waits at the
+    // prompt (see IdleWorker), so it may read buf without locking.
+    bool index_slice(){
+        if(!buf.tri || buf.streaming) return false;
+        return buf.tri->step(buf.lines);
+    }
+
+    // Attaches an index, reusing one saved by 'index save' when the file is
+    // clean and unchanged on disk.
+    bool attach_index(Buffer& b){
+        b.tri = std::make_shared<TrigramIndex>();
+        FileStamp st;
+        bool loaded = !b.dirty && !b.path.empty() && file_stamp(b.path, st) && b.tri->load(index_path_for(b), b.path, st, b.lines.size());
+        if(&b == &buf) indexer.kick();
+        return loaded;
+    }
+    // buf just became another buffer; its index may still need building.
+    void kick_index(){
+        if(buf.tri && (!buf.tri->ready || buf.tri->dirty)) indexer.kick();
+    }
+    void maybe_autoindex(Buffer& b){
+        if(autoindex_mb <= 0 || b.streaming || b.tri) return;
+        if(char_count(b) >= (size_t)autoindex_mb*1024*1024) attach_index(b);
+    }
+
+    void index_command(const string& rest){
+        string sub = lower(trim_copy(rest));
+        if(sub=="on"){
+            if(buf.streaming){ cout<<P.warn<<"index: not available while stdin is streaming"<<C_RESET<<"\n"; return; }
+            if(buf.tri){ cout<<"index: already on\n"; return; }
+            bool loaded = attach_index(buf);
+            if(!loaded && !isatty(STDIN_FILENO)) while(buf.tri->step(buf.lines)) {}
+            cout<<"index: "<<(loaded? "loaded from "+index_path_for(buf) : buf.tri->ready? string("built") : string("building in the background"))<<"\n";
+        } else if(sub=="off"){
+            if(buf.tri){ buf.tri.reset(); cout<<"index: off\n"; }
+            else cout<<"index: not on\n";
+        } else if(sub=="save"){
+            if(!buf.tri){ cout<<P.warn<<"index: not on"<<C_RESET<<"\n"; return; }
+            if(buf.dirty || buf.path.empty()){ cout<<P.warn<<"index: save the file first"<<C_RESET<<"\n"; return; }
+            while(buf.tri->step(buf.lines)) {}
+            FileStamp st; string err, path = index_path_for(buf);
+            if(!file_stamp(buf.path, st)){ cout<<P.err<<"index: cannot stat "<<buf.path<<C_RESET<<"\n"; return; }
+            if(!buf.tri->save(path, buf.path, st, buf.lines.size(), err)){ cout<<P.err<<"index: "<<err<<C_RESET<<"\n"; return; }
+            cout<<"index: saved to "<<path<<"\n";
+        } else if(sub.empty() || sub=="status"){
+            if(!buf.tri){ cout<<"index: off\n"; return; }
+            const TrigramIndex& t = *buf.tri;
+            size_t text = char_count(buf);
+            if(!t.ready) cout<<"index: building, "<<t.built<<"/"<<buf.lines.size()<<" lines";
+            else cout<<"index: ready, "<<t.blocks.size()<<" blocks ("<<t.dirty<<" pending)";
+            cout<<", "<<t.post.size()<<" trigrams, "<<t.entries<<" postings, "
+                <<std::fixed<<std::setprecision(1)<<(double)t.memory()/(1024.0*1024.0)<<" MB";
+            if(text) cout<<" ("<<100.0*(double)t.memory()/(double)text<<"% of text)";
+            cout<<std::defaultfloat<<"\n";
+        } else cout<<P.warn<<"usage: index [on|off|status|save]"<<C_RESET<<"\n";
+    }
+
     void append_mode(){
         cout<<"enter text; '.' alone ends (use \".\" for a literal '.')\n";
         string s; size_t added=0;
@@ -646,7 +1209,7 @@ struct Editor{
             else if(s==".") break;
             buf.lines.push_back(s); added++;
         }
-        if(added){ buf.dirty=true; cout<<"appended "<<added<<" line(s)\n"; }
+        if(added){ buf.dirty=true; lines_changed(buf.lines.size()-added+1, 0, added); cout<<"appended "<<added<<" line(s)\n"; }
     }
 
     void insert_mode(size_t before){
@@ -664,7 +1227,7 @@ struct Editor{
             }
             added++;
         }
-        if(added){ buf.dirty=true; cout<<"inserted "<<added<<" line(s)\n"; }
+        if(added){ buf.dirty=true; lines_changed(std::min(before, buf.lines.size()-added)+1, 0, added); cout<<"inserted "<<added<<" line(s)\n"; }
     }
 
     int gutter_width() const {
@@ -673,6 +1236,15 @@ struct Editor{
         return w + 3;
     }
 
+    string colorize_line(size_t i){
+        const string& L = buf.lines[i-1];
+        if(!use_color() || !buf.highlight) return L;
+        HlState st = hl_marks.state_at(buf, lang, i-1);
+        string out = colorize_lang(L, P, lang, st);
+        hl_marks.note(i-1, st);
+        return out;
+    }
+
     void print_line(size_t i){
         const int termw = term_width();
         const int gw = gutter_width();
@@ -684,7 +1256,7 @@ struct Editor{
             cont <<P.gutter<<std::string(gw-3, ' ')<<" | "<<C_RESET;
         }
 
-        string colored = colorize_lang(buf.lines[i-1], buf, P, lang);
+        string colored = colorize_line(i);
 
         if(wrap_long){
             print_wrapped_with_gutter(colored, first.str(), cont.str(), avail);
@@ -714,29 +1286,320 @@ struct Editor{
         for(size_t i=lo;i<=hi;i++) print_line(i);
     }
 
-    void repl(bool global, const string& old, const string& nw){
-        if(old.empty()){ cout<<P.warn<<"usage: repl[g] <old> <new>"<<C_RESET<<"\n"; return; }
-        push_undo(); int total=0;
-        for(string& L: buf.lines){
-            string out; int c = global? replace_all_line(L,old,nw,out): replace_first_line(L,old,nw,out);
-            if(c){ L.swap(out); total+=c; }
+    // Swaps rewritten lines into buf as one undo step that keeps only the
+    // old text of those lines (a Changed snap). Returns the replacement count.
+    size_t commit_edits(vector<LineEdit>& edits){
+        size_t total=0;
+        vector<size_t> changed;
+        Snap snap{Snap::Changed, {}, {}, buf.id};
+        snap.lines.reserve(edits.size()); snap.at.reserve(edits.size());
+        for(auto& e: edits){
+            buf.lines[e.idx].swap(e.text);
+            snap.at.push_back(e.idx);
+            snap.lines.push_back(std::move(e.text));
+            changed.push_back(e.idx+1);
+            total += e.count;
         }
-        if(total){ buf.dirty=true; cout<<"replaced "<<total<<" occurrence"<<(total==1?"":"s")<<(global?" (global)":" (first per line)")<<"\n"; }
+        if(total){ undo.push(std::move(snap)); redo.clear(); buf.dirty=true; }
+        lines_rewritten(changed);
+        return total;
+    }
+
+    void repl(bool global, const string& old, const string& nw, size_t lo, size_t hi){
+        if(old.empty()){ cout<<P.warn<<"usage: repl[g] [range] <old> <new>"<<C_RESET<<"\n"; return; }
+        vector<LineEdit> edits;
+        replace_lines(buf.lines, lo-1, hi, old, nw, global, edits);
+        size_t total = commit_edits(edits);
+        if(total){ cout<<"replaced "<<total<<" occurrence"<<(total==1?"":"s")<<(global?" (global)":" (first per line)")<<"\n"; }
         else { cout<<"no occurrences\n"; }
     }
 
+    // Splits "/a/b/c" on its first character; a backslash escapes it. At
+    // most `max` parts are split off, the last one keeps the rest verbatim.
+    static vector<string> split_delimited(const string& body, size_t max){
+        char d = body[0];
+        vector<string> parts(1);
+        for(size_t k=1;k<body.size();++k){
+            char c = body[k];
+            if(parts.size()==max){ parts.back().push_back(c); continue; }
+            if(c=='\\' && k+1<body.size() && body[k+1]==d){ parts.back().push_back(d); k++; continue; }
+            if(c==d){ parts.emplace_back(); continue; }
+            parts.back().push_back(c);
+        }
+        return parts;
+    }
+
+    // s/re/rep/[gin] over spans: any punctuation can stand in for '/', and
+    // a backslash escapes it. In rep, \N is an alias for $N, \t is a tab and
+    // \\ a backslash; other letter escapes (\n included, since a line cannot
+    // be split here) are rejected. $&, $N, $NN, $` and $' follow the
+    // ECMAScript rules.
+    void substitute(const vector<LineSpan>& spans, const string& body){
+        const char* usage = "usage: [range]s/regex/replacement/[g][i][n]";
+        vector<string> parts = split_delimited(body, 4);
+        if(parts.size()<2 || parts.size()>3 || parts[0].empty()){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+        bool global=false, icase=false, dry=false;
+        if(parts.size()==3) for(char f: parts[2]){
+            if(f=='g') global=true;
+            else if(f=='i') icase=true;
+            else if(f=='n') dry=true;
+            else { cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+        }
+        string fmt;
+        const string& r = parts[1];
+        for(size_t k=0;k<r.size();++k){
+            if(r[k]!='\\' || k+1>=r.size()){ fmt.push_back(r[k]); continue; }
+            char e = r[++k];
+            if(std::isdigit((unsigned char)e)){ fmt.push_back('$'); fmt.push_back(e); }
+            else if(e=='$'){ fmt += "$$"; }
+            else if(e=='t'){ fmt.push_back('\t'); }
+            else if(std::isalpha((unsigned char)e)){
+                cout<<P.warn<<"s: unknown escape \\"<<e<<" in replacement"<<(e=='n'?" (substitution cannot split lines)":"")<<C_RESET<<"\n";
+                return;
+            }
+            else fmt.push_back(e);
+        }
+        vector<LineEdit> edits;
+        try{
+            auto rx = compiled_regex(parts[0], icase);
+            substitute_spans(buf.lines, spans, *rx, fmt, global, edits);
+        } catch(const std::exception& e){ cout<<"regex: "<<e.what()<<"\n"; return; }
+        size_t total = 0;
+        for(auto& e: edits) total += e.count;
+        if(dry){ cout<<total<<" match"<<(total==1?"":"es")<<" on "<<edits.size()<<" line"<<(edits.size()==1?"":"s")<<"\n"; return; }
+        commit_edits(edits);
+        if(total) cout<<"substituted "<<total<<" match"<<(total==1?"":"es")<<" on "<<edits.size()<<" line"<<(edits.size()==1?"":"s")<<"\n";
+        else cout<<"no matches\n";
+    }
+
+    // Deletes the given lines (sorted, 1-based) in one pass as one undo step.
+    void delete_lines(const vector<size_t>& del){
+        if(del.empty()){ cout<<"deleted 0 line(s)\n"; return; }
+        push_undo();
+        vector<LineSpan> runs;
+        size_t w = 0, k = 0;
+        for(size_t i=0;i<buf.lines.size();++i){
+            if(k < del.size() && del[k] == i+1){
+                if(!runs.empty() && runs.back().second == i) runs.back().second = i+1;
+                else runs.push_back({i, i+1});
+                k++;
+                continue;
+            }
+            if(w != i) buf.lines[w] = std::move(buf.lines[i]);
+            w++;
+        }
+        buf.lines.resize(w);
+        buf.dirty = true;
+        if(runs.size() > 64) buffer_replaced();
+        else for(size_t r=runs.size(); r-- > 0;) lines_changed(runs[r].first+1, runs[r].second-runs[r].first, 0);
+        cout<<"deleted "<<del.size()<<" line(s)\n";
+    }
+
+    // "@name" for the current buffer; warns and returns null when there is
+    // no such set or it was built on another buffer.
+    const LineSet* find_set(const string& tok){
+        auto it = line_sets.find(tok.substr(1));
+        if(it==line_sets.end()){ cout<<P.warn<<"no line set "<<tok<<C_RESET<<"\n"; return nullptr; }
+        if(it->second.buf_id != buf.id){ cout<<P.warn<<tok<<" belongs to another buffer"<<C_RESET<<"\n"; return nullptr; }
+        return &it->second;
+    }
+
+    // Named line sets. Sets hold line numbers as they were when built; later
+    // edits do not move them, and lines past the end are ignored.
+    void sel_command(const string& rest){
+        const char* usage = "usage: sel [<name> find|findi|findre|findrei <pattern> | <name> <@set|range> [|&- <@set|range>]... | drop <name> | clear]";
+        std::istringstream ts(rest); string name; ts>>name;
+        if(name.empty()){
+            if(line_sets.empty()){ cout<<"no line sets\n"; return; }
+            for(auto& kv: line_sets){
+                const LineSet& s = kv.second;
+                size_t arrays = 0;
+                for(auto& c: s.chunks) if(!c.bitmap()) arrays++;
+                string owner = "(closed buffer)";
+                if(s.buf_id == buf.id) owner = buffer_label(buf);
+                for(auto& b: others) if(s.buf_id == b.id) owner = buffer_label(b);
+                cout<<"@"<<kv.first<<": "<<s.size()<<" line(s), "<<arrays<<" array + "<<(s.chunks.size()-arrays)<<" bitmap chunk(s), "
+                    <<human_bytes(s.memory())<<"  "<<P.dim<<owner<<C_RESET<<"\n";
+            }
+            return;
+        }
+        if(name=="clear"){ line_sets.clear(); cout<<"line sets cleared\n"; return; }
+        if(name=="drop"){
+            string n; ts>>n;
+            if(!n.empty() && n[0]=='@') n.erase(0, 1);
+            if(!line_sets.erase(n)){ cout<<P.warn<<"no line set @"<<n<<C_RESET<<"\n"; return; }
+            cout<<"dropped @"<<n<<"\n";
+            return;
+        }
+        if(name[0]=='@') name.erase(0, 1);
+        bool ok = !name.empty();
+        for(char c: name) if(!std::isalnum((unsigned char)c) && c!='_') ok = false;
+        if(!ok){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+        string src; ts>>src;
+        string arg; std::getline(ts, arg); arg = trim_copy(arg);
+        if(src.empty()){
+            const LineSet* s = find_set("@" + name);
+            if(s) cout<<"@"<<name<<": "<<s->size()<<" line(s)\n";
+            return;
+        }
+        LineSet out;
+        string ls = lower(src);
+        if(ls=="find" || ls=="findi" || ls=="findre" || ls=="findrei"){
+            if(arg.empty()){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+            vector<size_t> hits;
+            if(ls=="find" || ls=="findi") search_plain_allhits(buf, arg, ls=="findi", hits);
+            else try{
+                auto rx = compiled_regex(arg, ls=="findrei");
+                search_regex_allhits(buf, *rx, hits);
+            } catch(const std::exception& e){ cout<<"regex: "<<e.what()<<"\n"; return; }
+            out = LineSet::from_sorted(hits);
+        } else {
+            vector<string> toks{src};
+            std::istringstream es(arg);
+            for(string t; es>>t;) toks.push_back(t);
+            if(toks.size()%2 == 0){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+            for(size_t k=0;k<toks.size();k+=2){
+                LineSet v;
+                const string& t = toks[k];
+                if(t[0]=='@'){
+                    const LineSet* s = find_set(t);
+                    if(!s) return;
+                    if(k == 0){ out = *s; continue; }
+                    if(toks[k-1].size()!=1 || !strchr("|&-", toks[k-1][0])){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+                    out = LineSet::combine(out, *s, toks[k-1][0]);
+                    continue;
+                }
+                size_t lo=1, hi=0;
+                if(!looks_like_range_token(t) || !parse_range(t, buf.lines.size(), lo, hi)){ cout<<P.warn<<"bad range "<<t<<C_RESET<<"\n"; return; }
+                if(hi >= lo) v = LineSet::from_range(lo, hi);
+                if(k == 0){ out = std::move(v); continue; }
+                if(toks[k-1].size()!=1 || !strchr("|&-", toks[k-1][0])){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+                out = LineSet::combine(out, v, toks[k-1][0]);
+            }
+        }
+        out.buf_id = buf.id;
+        size_t n = out.size();
+        line_sets[name] = std::move(out);
+        cout<<"@"<<name<<": "<<n<<" line(s)\n";
+    }
+
+    // [range]g/re/cmd runs cmd once over every line matching re (v: every
+    // line not matching). Lines are collected in one scan and cmd applied to
+    // them as a batch with a single undo step. cmd is p (the default), d,
+    // s/re/rep/[gin] or "lua <function>"; the function gets (line, text) and
+    // may return a replacement string.
+    void global_command(size_t lo, size_t hi, bool invert, const string& body){
+        const char* usage = "usage: [range]g/regex/[p|d|s/re/rep/[gin]|lua <function>]  (v for non-matching lines)";
+        vector<string> parts = split_delimited(body, 2);
+        if(parts[0].empty()){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+        string cmd = parts.size()>1? trim_copy(parts[1]) : string();
+        vector<size_t> hits;
+        try{
+            auto rx = compiled_regex(parts[0], false);
+            vector<LineSpan> spans, cand;
+            if(!invert && buf.tri && buf.tri->candidates(rx->literal_prefix(), cand)){
+                for(auto& c: cand){
+                    size_t a = std::max(c.first, lo-1), b = std::min(c.second, hi);
+                    if(a < b) spans.push_back({a, b});
+                }
+            } else if(lo <= hi) spans.push_back({lo-1, hi});
+            parallel_span_scan(buf.lines, spans, [&](const string& L){ return rx->search(L) != invert; }, hits);
+        } catch(const std::exception& e){ cout<<"regex: "<<e.what()<<"\n"; return; }
+        if(hits.empty()){ cout<<"no matches\n"; return; }
+        vector<LineSpan> runs;
+        for(size_t ln: hits){
+            if(!runs.empty() && runs.back().second == ln-1) runs.back().second = ln;
+            else runs.push_back({ln-1, ln});
+        }
+
+        string verb = lower(cmd.substr(0, cmd.find(' ')));
+        if(cmd.empty() || verb=="p" || verb=="print"){
+            for(size_t ln: hits) print_line(ln);
+            return;
+        }
+        if(verb=="d" || verb=="delete"){
+            delete_lines(hits);
+            return;
+        }
+        if(cmd.size()>1 && cmd[0]=='s' && std::ispunct((unsigned char)cmd[1])){
+            substitute(runs, cmd.substr(1));
+            return;
+        }
+        if(verb=="lua"){
+            string fn = trim_copy(cmd.substr(3));
+            if(!L || fn.empty()){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+            uint64_t id = buf.id;
+            size_t n = buf.lines.size();
+            vector<LineEdit> edits;
+            for(size_t ln: hits){
+                lua_getglobal(L, fn.c_str());
+                if(!lua_isfunction(L, -1)){ lua_pop(L, 1); cout<<P.warn<<"lua: no function "<<fn<<C_RESET<<"\n"; return; }
+                lua_pushinteger(L, (lua_Integer)ln);
+                lua_pushlstring(L, buf.lines[ln-1].data(), buf.lines[ln-1].size());
+                if(lua_pcall(L, 2, 1, 0) != LUA_OK){
+                    cout<<C_RED<<"lua: "<<lua_tostring(L, -1)<<C_RESET<<"\n";
+                    lua_pop(L, 1);
+                    return;
+                }
+                if(buf.id != id || buf.lines.size() != n){
+                    lua_pop(L, 1);
+                    cout<<P.warn<<"lua: "<<fn<<" changed the buffer; nothing applied"<<C_RESET<<"\n";
+                    return;
+                }
+                if(lua_type(L, -1) == LUA_TSTRING){
+                    size_t len = 0;
+                    const char* s = lua_tolstring(L, -1, &len);
+                    if(buf.lines[ln-1].compare(0, string::npos, s, len) != 0) edits.push_back(LineEdit{ln-1, string(s, len), 1});
+                }
+                lua_pop(L, 1);
+            }
+            size_t total = commit_edits(edits);
+            cout<<"lua: "<<fn<<" ran on "<<hits.size()<<" line(s), changed "<<total<<"\n";
+            return;
+        }
+        cout<<P.warn<<usage<<C_RESET<<"\n";
+    }
+
     void info(){
         struct stat st{}; bool have = (!buf.path.empty() && ::stat(buf.path.c_str(), &st)==0);
         cout<<"file: "<<(buf.path.empty()? "(unnamed)": buf.path)<<(buf.dirty?" *":"")<<"\n";
         cout<<"  lines: "<<buf.lines.size()<<", chars: "<<char_count(buf)<<"\n";
         if(have){ cout<<"  size: "<<(long long)st.st_size<<" bytes, mode: "<<std::oct<< (st.st_mode & 0777) << std::dec <<"\n"; }
         else cout<<"  on-disk: (none)\n";
+        cout<<"  encoding: "<<encoding_name(buf.enc, buf.bom)<<"\n";
+    }
+
+    // findf [-d <char>] <field|key> <op> <value>: the hits become the
+    // current search, so n and N step through them.
+    void find_field(const string& rest){
+        const char* usage = "usage: findf [-d <char>] <field|key> =|!=|<|<=|>|>=|~|!~ <value>";
+        std::istringstream ts(rest);
+        string field, op;
+        char delim = 0;
+        ts>>field;
+        if(field=="-d"){
+            string d; ts>>d;
+            if(d=="\\t" || d=="tab") d = "\t";
+            if(d.size()!=1){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+            delim = d[0];
+            ts>>field;
+        }
+        ts>>op;
+        string val; std::getline(ts, val); val = trim_copy(val);
+        if(val.size()>=2 && val.front()=='"' && val.back()=='"') val = val.substr(1, val.size()-2);
+        if(field.empty() || op.empty()){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+        auto q = std::make_shared<FieldQuery>();
+        string err;
+        if(!q->parse(field, op, val, delim, err)){ cout<<P.warn<<"findf: "<<err<<C_RESET<<"\n"; return; }
+        last_search = "findf " + trim_copy(rest); last_icase = false; last_index = 0;
+        last_test = [q](const string& L){ return q->matches(L); };
+        last_need = q->required();
+        print_hits(buf, matches.get_custom(buf, last_search, last_test, last_need));
     }
 
     void next_match(bool reverse){
         if(last_search.empty()){ cout<<"(no previous search)\n"; return; }
-        vector<size_t> hits;
-        search_plain_allhits(buf,last_search,last_icase,hits);
+        const vector<size_t>& hits = last_test? matches.get_custom(buf,last_search,last_test,last_need) : matches.get(buf,last_search,last_icase);
         if(hits.empty()){ cout<<"no matches\n"; return; }
         if(!reverse){
             auto it = std::upper_bound(hits.begin(), hits.end(), last_index);
@@ -778,9 +1641,10 @@ struct Editor{
     void open_new_buffer(const string& path){
         others.push_back(buf);
         Buffer nb;
-        if(!path.empty()){ nb.path=path; load_file(path, nb); maybe_recover(nb); }
+        if(!path.empty()){ nb.path=path; load_file(path, nb); maybe_recover(nb); maybe_autoindex(nb); }
         buf = std::move(nb);
         lang = detect_lang(buf.path);
+        kick_index();
         add_recent(buf.path);
         cout<<P.ok<<"(new buffer) "<<(path.empty()? "(unnamed)":path)<<C_RESET<<"\n";
     }
@@ -790,6 +1654,7 @@ struct Editor{
         nb.path = p;
         load_file(p, nb);
         maybe_recover(nb);
+        maybe_autoindex(nb);
         others.push_back(std::move(nb));
         add_recent(p);
     }
@@ -806,6 +1671,7 @@ struct Editor{
         buf = others.back();
         others.pop_back();
         lang = detect_lang(buf.path);
+        kick_index();
         cout<<"[bnext] "<<(buf.path.empty()? "(unnamed)":buf.path)<<"\n";
     }
     void bprev(){
@@ -815,19 +1681,153 @@ struct Editor{
         others.push_back(buf);
         buf = prev;
         lang = detect_lang(buf.path);
+        kick_index();
         cout<<"[bprev] "<<(buf.path.empty()? "(unnamed)":buf.path)<<"\n";
     }
+    static string buffer_label(const Buffer& b){
+        return b.streaming? "(stdin)" : b.path.empty()? "(unnamed)" : b.path;
+    }
+
+    void find_all(const string& q, bool icase, bool regex){
+        vector<const Buffer*> bufs{&buf};
+        for(auto& b: others) bufs.push_back(&b);
+        vector<vector<size_t>> res;
+        try{
+            if(regex){
+                auto rx = compiled_regex(q, icase);
+                search_buffers(bufs, rx->literal_prefix(), [&](const string& L){ return rx->search(L); }, res);
+            } else {
+                LiteralMatcher lm(q, icase);
+                search_buffers(bufs, q, [&](const string& L){ return lm.matches(L); }, res);
+            }
+        } catch(const std::exception& e){ cout<<"regex: "<<e.what()<<"\n"; return; }
+        all_hits = HitList{q, icase, regex, {}, 0};
+        size_t nbuf = 0;
+        for(size_t d=0;d<bufs.size();++d){
+            if(res[d].empty()) continue;
+            nbuf++;
+            string name = buffer_label(*bufs[d]);
+            for(size_t ln: res[d]){
+                all_hits.hits.push_back({bufs[d]->id, ln, string()});
+                cout<<P.dim<<"["<<all_hits.hits.size()<<"]"<<C_RESET<<" "<<name<<":"<<ln<<": "<<bufs[d]->lines[ln-1]<<"\n";
+            }
+        }
+        if(all_hits.hits.empty()){ cout<<"no matches\n"; return; }
+        cout<<all_hits.hits.size()<<" match(es) in "<<nbuf<<" buffer(s); 'jump <k>' opens one\n";
+    }
+
+    // fuzzy [-n K] <query>: the K best lines (default 20), best first. The
+    // ranking becomes the jump list.
+    void fuzzy_command(const string& rest){
+        const char* usage = "usage: fuzzy [-n <count>] <query>";
+        string q = rest;
+        long k = 20;
+        if(q.compare(0, 3, "-n ")==0){
+            std::istringstream ts(q.substr(3)); string ks; ts>>ks;
+            if(!parse_long(ks, k) || k < 1){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+            std::getline(ts, q);
+            q = trim_copy(q);
+        }
+        if(q.empty()){ cout<<P.warn<<usage<<C_RESET<<"\n"; return; }
+        FuzzyQuery fq(q);
+        vector<FuzzyHit> top;
+        size_t matched = 0;
+        fuzzy_top(buf.lines, fq, (size_t)k, top, matched);
+        if(top.empty()){ cout<<"no matches\n"; return; }
+        all_hits = HitList{q, fq.icase, true, {}, 0};
+        vector<size_t> pos;
+        for(auto& h: top){
+            all_hits.hits.push_back({buf.id, h.line, string()});
+            const string& L = buf.lines[h.line-1];
+            long sc;
+            pos.clear();
+            fq.score(L, sc, &pos);
+            cout<<P.dim<<"["<<all_hits.hits.size()<<"]"<<C_RESET<<" "<<h.line<<" "<<P.dim<<"("<<h.score<<")"<<C_RESET<<": ";
+            size_t j = 0;
+            for(size_t i=0;i<L.size();++i){
+                bool hit = j < pos.size() && pos[j] == i;
+                if(hit) j++;
+                if(hit && (unsigned char)L[i] < 128) cout<<P.accent<<L[i]<<C_RESET;
+                else cout<<L[i];
+            }
+            cout<<"\n";
+        }
+        cout<<"best "<<top.size()<<" of "<<matched<<" matching line(s); 'jump <k>' goes to one\n";
+    }
+
+    void grep_command(const string& rest){
+        std::istringstream ts(rest);
+        bool icase=false, regex=false, hidden=false;
+        string pat, tok;
+        while(ts>>std::ws && ts.peek()=='-'){
+            ts>>tok;
+            if(tok=="-i") icase=true;
+            else if(tok=="-E") regex=true;
+            else if(tok=="-a") hidden=true;
+            else { pat=tok; break; }
+        }
+        if(pat.empty()) ts>>std::quoted(pat);
+        string dir; std::getline(ts, dir); dir = trim_copy(dir);
+        if(pat.empty()){ cout<<P.warn<<"usage: grep [-i] [-E] [-a] <pattern> [dir]"<<C_RESET<<"\n"; return; }
+        dir = dir.empty()? "." : expand_path(dir);
+        std::error_code ec;
+        if(!fs::exists(dir, ec)){ cout<<P.err<<"grep: "<<dir<<": no such file or directory"<<C_RESET<<"\n"; return; }
+        vector<GrepHit> hits; GrepStats st;
+        try{
+            if(regex){
+                auto rx = compiled_regex(pat, icase);
+                bool folded = false;
+                string lit = rx->literal_prefix(&folded);
+                LiteralMatcher pre(lit, rx->icase || folded);
+                grep_tree(dir, hidden, lit.empty()? nullptr : &pre, [&](const char* p, size_t n){ return rx->search(p, n); }, P, hits, st);
+            } else {
+                LiteralMatcher lm(pat, icase);
+                grep_tree(dir, hidden, &lm, [](const char*, size_t){ return true; }, P, hits, st);
+            }
+        } catch(const std::exception& e){ cout<<"regex: "<<e.what()<<"\n"; return; }
+        all_hits = HitList{pat, icase, regex, {}, 0};
+        for(auto& h: hits) all_hits.hits.push_back({0, h.line, h.path});
+        cout<<st.hits<<" match(es) in "<<st.files<<" file(s)";
+        if(st.skipped) cout<<", "<<st.skipped<<" binary or unreadable skipped";
+        cout<<(st.hits? "; 'jump <k>' opens one\n" : "\n");
+    }
+
+    // Makes hit k (1-based) current: switches to its buffer and sets the
+    // search state so n/N continue from there.
+    void jump_to(size_t k){
+        if(all_hits.hits.empty()){ cout<<"(no findall or grep results)\n"; return; }
+        if(k < 1 || k > all_hits.hits.size()){ cout<<P.warn<<"jump: hit numbers run 1-"<<all_hits.hits.size()<<C_RESET<<"\n"; return; }
+        const HitList::Hit hit = all_hits.hits[k-1];
+        auto same = [&](const Buffer& b){
+            if(hit.buf) return b.id == hit.buf;
+            std::error_code ec;
+            return !b.path.empty() && fs::equivalent(b.path, hit.path, ec);
+        };
+        if(!same(buf)){
+            size_t i = 0;
+            while(i < others.size() && !same(others[i])) ++i;
+            if(i < others.size()) switch_buffer(i+1);
+            else if(hit.buf){ cout<<P.warn<<"jump: that buffer was closed"<<C_RESET<<"\n"; return; }
+            else open_new_buffer(hit.path);
+        }
+        if(hit.line > buf.lines.size()){ cout<<P.warn<<"jump: line "<<hit.line<<" no longer exists"<<C_RESET<<"\n"; return; }
+        all_hits.cur = k;
+        if(!all_hits.regex){ last_search = all_hits.pat; last_icase = all_hits.icase; last_test = nullptr; }
+        last_index = hit.line;
+        print(last_index, last_index);
+    }
+
     void switch_buffer(size_t idx){
         if(idx == 0){ cout<<"[buffer] "<<(buf.path.empty()?"(unnamed)":buf.path)<<"\n"; return; }
         if(idx > others.size()){ cout<<P.warn<<"buffer: no such buffer"<<C_RESET<<"\n"; return; }
-        Buffer cur = buf;
-        buf = others[idx-1];
-        others[idx-1] = cur;
+        std::swap(buf, others[idx-1]);
         lang = detect_lang(buf.path);
+        kick_index();
         cout<<"[buffer] "<<(buf.path.empty()?"(unnamed)":buf.path)<<"\n";
     }
     bool close_buffer(){
         if(buf.dirty){ cout<<P.warn<<"close: unsaved changes (use q! to discard or save first)"<<C_RESET<<"\n"; return true; }
+        drop_history();
         if(others.empty()){
             buf = Buffer{};
             lang = Lang::Plain;
@@ -837,6 +1837,7 @@ struct Editor{
         buf = others.back();
         others.pop_back();
         lang = detect_lang(buf.path);
+        kick_index();
         cout<<"[close] "<<(buf.path.empty()?"(unnamed)":buf.path)<<"\n";
         return true;
     }
@@ -872,7 +1873,37 @@ struct Editor{
         return in;
     }
 
+    // Called by the line reader on every key typed at the '/' prompt. While
+    // the query only grows, just the previous query's hits are rescanned.
+    bool live_search(const string& q, const std::function<bool()>& stop, vector<string>& rows){
+        rows.clear();
+        if(q.empty()){ live.valid = false; return true; }
+        bool narrow = live.valid && live.buf_id==buf.id && live.line_count==buf.lines.size() && q.find(live.q)!=string::npos;
+        vector<size_t> hits;
+        indexer.pause();
+        bool done = search_plain_cancellable(buf, q, narrow? &live.hits : nullptr, stop, hits);
+        indexer.resume();
+        if(!done) return false;
+        live.buf_id = buf.id; live.line_count = buf.lines.size(); live.q = q; live.valid = true;
+        live.hits.swap(hits);
+        const size_t cols = (size_t)std::max(20, term_width() - 1);
+        rows.push_back(P.dim + std::to_string(live.hits.size()) + (live.hits.size()==1? " match" : " matches") + C_RESET);
+        for(size_t k=0; k<live.hits.size() && k<LIVE_ROWS; ++k){
+            string row = std::to_string(live.hits[k]) + ": ";
+            size_t w = row.size();
+            for(char c: buf.lines[live.hits[k]-1]){
+                bool lead = ((unsigned char)c & 0xC0) != 0x80;
+                if(lead && w++ >= cols) break;
+                row.push_back((unsigned char)c < 32? ' ' : c);
+            }
+            rows.push_back(row);
+        }
+        return true;
+    }
+
     bool handle(const string& raw){
+        live.valid = false;
+        pump_stdin();
         autosave_if_needed(buf, last_autosave, autosave_sec);
 
         string in = trim_copy(raw);
@@ -894,8 +1925,20 @@ struct Editor{
         }
 
         if(!in.empty() && in[0]=='/'){
-            string q=in.substr(1); last_search=q; last_icase=false; last_index=0;
-            search_plain(buf,q,false); return true;
+            string q=in.substr(1); last_search=q; last_icase=false; last_index=0; last_test=nullptr;
+            print_hits(buf, matches.get(buf,q,false)); return true;
+        }
+
+        {
+            size_t k=0;
+            while(k<in.size() && (std::isdigit((unsigned char)in[k]) || in[k]=='$' || in[k]=='-')) k++;
+            if(k+1<in.size() && (in[k]=='s' || in[k]=='g' || in[k]=='v') && std::ispunct((unsigned char)in[k+1]) && in[k+1]!='-' && in[k+1]!='\\'){
+                size_t lo=1, hi=buf.lines.size();
+                if(k && !parse_range(in.substr(0,k),buf.lines.size(),lo,hi)){ cout<<P.warn<<"bad range"<<C_RESET<<"\n"; return true; }
+                if(in[k]=='s') substitute(vector<LineSpan>{{lo-1, std::max(lo-1, hi)}}, in.substr(k+1));
+                else global_command(lo, hi, in[k]=='v', in.substr(k+1));
+                return true;
+            }
         }
 
         std::istringstream ss(in); string cmd; ss>>cmd; string rest; std::getline(ss,rest); rest=trim_copy(rest);
@@ -927,11 +1970,12 @@ struct Editor{
         if(lc=="write"){
             std::istringstream ts(rest); string tok1; ts>>tok1;
             string tok2; ts>>tok2;
-            if(tok2.empty() || !looks_like_range_token(tok1)){ save(rest); return true; }
+            if(tok2.empty() || !(looks_like_range_token(tok1) || tok1[0]=='@')){ save(rest); return true; }
         }
         if(lc=="saveas"){ if(rest.empty()){ cout<<P.warn<<"usage: saveas <path>"<<C_RESET<<"\n"; return true; } save(rest); return true; }
 
         if(lc=="quit"||lc=="q"){
+            if(hex.dirty()){ cout<<P.warn<<"hex: unsaved patches in "<<hex.path<<" (hex write or hex close!)"<<C_RESET<<"\n"; return true; }
             if(buf.dirty){
                 cout<<P.warn<<"Save changes to file? [y]es/[n]o/[c]ancel "<<C_RESET<<std::flush;
                 char c=0; std::cin.get(c); string dump; std::getline(std::cin,dump);
@@ -942,6 +1986,14 @@ struct Editor{
         }
 
         if(lc=="print"||lc=="p"){
+            if(!rest.empty() && rest[0]=='@'){
+                const LineSet* s = find_set(rest);
+                if(!s) return true;
+                size_t n = buf.lines.size(), shown = 0;
+                s->each([&](size_t ln){ if(ln > n) return false; print_line(ln); shown++; return true; });
+                if(!shown) cout<<"(empty)\n";
+                return true;
+            }
             size_t lo=1,hi=buf.lines.size();
             if(!parse_range(rest,buf.lines.size(),lo,hi)){ cout<<P.warn<<"bad range"<<C_RESET<<"\n"; return true; }
             print(lo,hi); return true;
@@ -990,6 +2042,7 @@ struct Editor{
                 push_undo();
                 buf.lines[(size_t)n-1] = newline;
                 buf.dirty = true;
+                lines_changed((size_t)n, 1, 1);
                 cout<<"edited line "<<n<<"\n";
                 return true;
             }
@@ -1000,12 +2053,21 @@ struct Editor{
             push_undo();
             buf.lines[(size_t)n-1] = after;
             buf.dirty = true;
+            lines_changed((size_t)n, 1, 1);
             cout<<"edited line "<<n<<"\n";
             return true;
         }
 
         if(lc=="delete"||lc=="d"){
             if(buf.lines.empty()){ cout<<"(empty)\n"; return true; }
+            if(!rest.empty() && rest[0]=='@'){
+                const LineSet* s = find_set(rest);
+                if(!s) return true;
+                vector<size_t> del;
+                s->to_vector(buf.lines.size(), del);
+                delete_lines(del);
+                return true;
+            }
             size_t lo=1,hi=buf.lines.size();
             if(!parse_range(rest,buf.lines.size(),lo,hi)){ cout<<P.warn<<"bad range"<<C_RESET<<"\n"; return true; }
             push_undo();
@@ -1013,6 +2075,7 @@ struct Editor{
             buf.lines.erase(buf.lines.begin()+ (long)lo-1,
                             buf.lines.begin()+ (long)lo-1 + (long)count);
             buf.dirty=true;
+            lines_changed(lo, count, 0);
             cout<<"deleted "<<count<<" line(s)\n";
             return true;
         }
@@ -1026,9 +2089,11 @@ struct Editor{
             push_undo();
             string s=buf.lines[(size_t)from-1];
             buf.lines.erase(buf.lines.begin()+ (long)from-1);
+            lines_changed((size_t)from, 1, 0);
             if(to>from) to--;
             if(to>(long)buf.lines.size()) to=(long)buf.lines.size();
             buf.lines.insert(buf.lines.begin()+ (long)to, s);
+            lines_changed((size_t)to+1, 0, 1);
             buf.dirty=true;
             cout<<"moved line "<<from<<" to "<<to<<"\n";
             return true;
@@ -1044,12 +2109,15 @@ struct Editor{
                             buf.lines.begin()+ (long)hi);
             buf.lines.insert(buf.lines.begin()+ (long)lo-1, out.str());
             buf.dirty=true;
+            lines_changed(lo, hi-lo+1, 1);
             cout<<"joined\n";
             return true;
         }
 
-        if(lc=="find"){ if(rest.empty()){ cout<<P.warn<<"usage: find <text>"<<C_RESET<<"\n"; return true; } last_search=rest; last_icase=false; last_index=0; search_plain(buf,rest,false); return true; }
-        if(lc=="findi"){ if(rest.empty()){ cout<<P.warn<<"usage: findi <text>"<<C_RESET<<"\n"; return true; } last_search=rest; last_icase=true;  last_index=0; search_plain(buf,rest,true);  return true; }
+        if(lc=="find"){ if(rest.empty()){ cout<<P.warn<<"usage: find <text>"<<C_RESET<<"\n"; return true; } last_search=rest; last_icase=false; last_index=0; last_test=nullptr; print_hits(buf, matches.get(buf,rest,false)); return true; }
+        if(lc=="findi"){ if(rest.empty()){ cout<<P.warn<<"usage: findi <text>"<<C_RESET<<"\n"; return true; } last_search=rest; last_icase=true;  last_index=0; last_test=nullptr; print_hits(buf, matches.get(buf,rest,true));  return true; }
+        if(lc=="findf"){ find_field(rest); return true; }
+        if(lc=="fuzzy"){ fuzzy_command(rest); return true; }
         if(lc=="findre"){
             bool icase=false;
             string pat=rest;
@@ -1057,11 +2125,57 @@ struct Editor{
             if(pat.empty()){ cout<<P.warn<<"usage: findre [-i] <regex>"<<C_RESET<<"\n"; return true; }
             search_regex(buf,pat,icase); return true;
         }
+        if(lc=="findall" || lc=="findreall"){
+            bool icase=false;
+            string pat=rest;
+            if(pat.rfind("-i ",0)==0){ icase=true; pat=trim_copy(pat.substr(3)); }
+            if(pat.empty()){ cout<<P.warn<<"usage: "<<lc<<" [-i] <"<<(lc=="findall"?"text":"regex")<<">"<<C_RESET<<"\n"; return true; }
+            find_all(pat, icase, lc=="findreall"); return true;
+        }
+        if(lc=="grep"){ grep_command(rest); return true; }
+        if(lc=="jump"){
+            long k=0;
+            if(rest.empty()) k = (long)all_hits.cur + 1;
+            else if(!parse_long(rest,k)){ cout<<P.warn<<"usage: jump [k]"<<C_RESET<<"\n"; return true; }
+            jump_to((size_t)std::max<long>(0,k)); return true;
+        }
+        if(lc=="findml"){
+            std::istringstream ts(rest); string tok; ts>>tok;
+            string pat=rest;
+            size_t lo=1, hi=buf.lines.size();
+            string after; std::getline(ts, after); after=trim_copy(after);
+            if(!after.empty() && looks_like_range_token(tok)){
+                if(!parse_range(tok,buf.lines.size(),lo,hi)){ cout<<P.warn<<"bad range"<<C_RESET<<"\n"; return true; }
+                pat=after;
+            }
+            bool icase=false;
+            if(pat.rfind("-i ",0)==0){ icase=true; pat=trim_copy(pat.substr(3)); }
+            if(pat.empty()){ cout<<P.warn<<"usage: findml [range] [-i] <regex>"<<C_RESET<<"\n"; return true; }
+            vector<std::pair<size_t,size_t>> hits;
+            try{ search_multiline(buf, lo, hi, *compiled_regex(pat, icase), hits); }
+            catch(const std::exception& e){ cout<<"regex: "<<e.what()<<"\n"; return true; }
+            if(hits.empty()){ cout<<"no matches\n"; return true; }
+            for(auto& h: hits){
+                cout<<"match at "<<h.first;
+                if(h.second!=h.first) cout<<"-"<<h.second;
+                cout<<": "<<buf.lines[h.first-1]<<(h.second!=h.first? " ..." : "")<<"\n";
+            }
+            return true;
+        }
         if(lc=="findrei"){ if(rest.empty()){ cout<<P.warn<<"usage: findrei <regex>"<<C_RESET<<"\n"; return true; } search_regex(buf,rest,true); return true; }
         if(cmd=="N"){ next_match(true);  return true; }
         if(lc=="n"){ next_match(false); return true; }
 
-        if(lc=="repl"||lc=="replg"){ bool g=(lc=="replg"); std::istringstream ts(rest); string old,nw; ts>>old>>nw; repl(g,old,nw); return true; }
+        if(lc=="repl"||lc=="replg"){
+            bool g=(lc=="replg");
+            std::istringstream ts(rest); string a,b,c; ts>>a>>b>>c;
+            size_t lo=1, hi=buf.lines.size();
+            if(!c.empty() && looks_like_range_token(a)){
+                if(!parse_range(a,buf.lines.size(),lo,hi)){ cout<<P.warn<<"bad range"<<C_RESET<<"\n"; return true; }
+                a=b; b=c;
+            }
+            repl(g,a,b,lo,hi); return true;
+        }
 
         if(lc=="read"){
             std::istringstream ts(rest); string p; long n=-1; ts>>p;
@@ -1077,6 +2191,7 @@ struct Editor{
             if(at>buf.lines.size()) at=buf.lines.size();
             buf.lines.insert(buf.lines.begin()+ (long)at, R.begin(), R.end());
             buf.dirty=true;
+            lines_changed(at+1, 0, R.size());
             cout<<"read "<<R.size()<<" line(s) from "<<p<<"\n";
             return true;
         }
@@ -1087,6 +2202,19 @@ struct Editor{
             size_t lo=1,hi=buf.lines.size(); string outp;
             string maybe_path;
             ts>>maybe_path;
+            if(!maybe_path.empty() && tok1[0]=='@'){
+                const LineSet* s = find_set(tok1);
+                if(!s) return true;
+                outp = expand_path(maybe_path);
+                Buffer tmp;
+                tmp.enc = buf.enc; tmp.bom = buf.bom;
+                size_t n = buf.lines.size();
+                s->each([&](size_t ln){ if(ln > n) return false; if(ln) tmp.lines.push_back(buf.lines[ln-1]); return true; });
+                string err;
+                if(atomic_save(outp, tmp, buf.backup, err)){ cout<<"wrote "<<tmp.lines.size()<<" line(s) to "<<outp<<"\n"; }
+                else cout<<P.err<<"write: "<<err<<C_RESET<<"\n";
+                return true;
+            }
             if(!maybe_path.empty() && looks_like_range_token(tok1)){
                 if(!parse_range(tok1,buf.lines.size(),lo,hi)){ cout<<P.warn<<"bad range"<<C_RESET<<"\n"; return true; }
                 outp=maybe_path;
@@ -1096,6 +2224,7 @@ struct Editor{
             }
             outp = expand_path(outp);
             Buffer tmp;
+            tmp.enc = buf.enc; tmp.bom = buf.bom;
             if(hi>=lo) tmp.lines.assign(buf.lines.begin()+ (long)lo-1, buf.lines.begin()+ (long)hi);
             string err;
             if(atomic_save(outp, tmp, buf.backup, err)){ cout<<"wrote "<<(hi>=lo?hi-lo+1:0)<<" line(s) to "<<outp<<"\n"; }
@@ -1109,8 +2238,8 @@ struct Editor{
             size_t lo=1,hi=buf.lines.size();
             if(!parse_range(rng,buf.lines.size(),lo,hi)){ cout<<P.warn<<"bad range"<<C_RESET<<"\n"; return true; }
             push_undo();
-            string ferr;
-            if(run_filter_replace(buf.lines,lo,hi, ex.substr(1), ferr)){ buf.dirty=true; cout<<"filtered\n"; }
+            string ferr; size_t before=buf.lines.size();
+            if(run_filter_replace(buf.lines,lo,hi, ex.substr(1), ferr)){ buf.dirty=true; lines_changed(lo, hi-lo+1, buf.lines.size()+hi-lo+1-before); cout<<"filtered\n"; }
             else { cout<<P.err<<"filter failed: "<<ferr<<C_RESET<<"\n"; }
             return true;
         }
@@ -1119,15 +2248,17 @@ struct Editor{
             long k=1; if(!rest.empty()) parse_long(rest,k);
             bool any=false;
             while(k-- > 0){
-                Snap s; if(!undo.pop(s)){ if(!any) cout<<"nothing to undo\n"; break; }
-                redo.push(buf); buf.lines = std::move(s.lines); buf.dirty=true; any=true;
+                if(undo.st.empty()){ if(!any) cout<<"nothing to undo\n"; break; }
+                if(!restore_snap(undo, redo, "undo")) break;
+                any=true;
             }
             if(any) cout<<"undo\n";
             return true;
         }
         if(lc=="redo"){
-            Snap s; if(!redo.pop(s)){ cout<<"nothing to redo\n"; return true; }
-            undo.push(buf); buf.lines = std::move(s.lines); buf.dirty=true; cout<<"redo\n"; return true;
+            if(redo.st.empty()){ cout<<"nothing to redo\n"; return true; }
+            if(restore_snap(redo, undo, "redo")) cout<<"redo\n";
+            return true;
         }
 
         if(lc=="set"){
@@ -1153,7 +2284,9 @@ struct Editor{
                 bool b=false; if(!parse_bool_string(val,b)){ cout<<P.warn<<"usage: set truncate on|off"<<C_RESET<<"\n"; return true; }
                 truncate_long=b; cout<<"truncate: "<<(truncate_long?"on":"off")<<"\n"; save_config();
             } else if(what=="lang"){
-                if(val=="cpp"||val=="c"||val=="c++"||val=="hpp"||val=="h") lang=Lang::Cpp;
+                Lang custom;
+                if(grammars().by_name(val, custom)) lang=custom;
+                else if(val=="cpp"||val=="c"||val=="c++"||val=="hpp"||val=="h") lang=Lang::Cpp;
                 else if(val=="py"||val=="python") lang=Lang::Python;
                 else if(val=="sh"||val=="bash"||val=="zsh"||val=="shell") lang=Lang::Shell;
                 else if(val=="rb"||val=="ruby") lang=Lang::Ruby;
@@ -1163,6 +2296,22 @@ struct Editor{
                 else if(val=="json") lang=Lang::JSON;
                 else lang=Lang::Plain;
                 cout<<"lang: set\n";
+            } else if(what=="encoding"){
+                Encoding e; bool bom=false;
+                if(!encoding_from_name(val, e, bom)){ cout<<P.warn<<"usage: set encoding utf8|utf8-bom|utf16le|utf16be|latin1"<<C_RESET<<"\n"; return true; }
+                if(e!=buf.enc || bom!=buf.bom){ buf.enc=e; buf.bom=bom; buf.dirty=true; }
+                cout<<"encoding: "<<encoding_name(buf.enc, buf.bom)<<"\n";
+            } else if(what=="threads"){
+                long n=0;
+                if(val=="auto") n=0;
+                else if(!parse_long(val,n) || n<1){ cout<<P.warn<<"usage: set threads <n>|auto"<<C_RESET<<"\n"; return true; }
+                WorkerPool::get().limit=(size_t)n;
+                cout<<"threads: "<<threads_name()<<"\n"; save_config();
+            } else if(what=="autoindex"){
+                long n=0;
+                if(val!="off" && (!parse_long(val,n) || n<1)){ cout<<P.warn<<"usage: set autoindex <mb>|off"<<C_RESET<<"\n"; return true; }
+                autoindex_mb=n;
+                cout<<"autoindex: "<<(n? std::to_string(n)+" MB" : string("off"))<<"\n"; save_config();
             } else cout<<P.warn<<"unknown setting"<<C_RESET<<"\n";
             return true;
         }
@@ -1387,6 +2536,15 @@ struct Editor{
                         }
                     }
                 }
+                if(grammars().live_count()){
+                    cout<<"grammars:\n";
+                    for(auto& g: grammars().slots){
+                        if(!g->live) continue;
+                        cout<<"- "<<g->name;
+                        for(auto& e: g->extensions) cout<<" "<<e;
+                        cout<<"\n";
+                    }
+                }
                 return true;
             }
 
@@ -1396,7 +2554,35 @@ struct Editor{
                     return true;
                 }
                 load_lua_plugins();
-                cout<<"plugins reloaded\n";
+                load_grammars();
+                cout<<"plugins reloaded ("<<grammars().live_count()<<" grammar"<<(grammars().live_count()==1?"":"s")<<")\n";
+                return true;
+            }
+
+            if(lc=="hex"){ hex_command(rest); return true; }
+            if(lc=="session"){ session_command(rest); return true; }
+
+            if(lc=="index"){ index_command(rest); return true; }
+            if(lc=="sel"){ sel_command(rest); return true; }
+
+            if(lc=="stats"){
+                if(lower(rest)=="reset"){ regex_cache().clear(); hl_cache().clear(); cout<<"stats: reset\n"; return true; }
+                if(!rest.empty()){ cout<<P.warn<<"usage: stats [reset]"<<C_RESET<<"\n"; return true; }
+                show_stats();
+                return true;
+            }
+
+            if(lc=="bench"){
+                std::istringstream ts(rest); string what, mbs; ts>>what>>mbs;
+                long mb = 64;
+                if(!mbs.empty() && (!parse_long(mbs, mb) || mb<=0)){ cout<<P.warn<<"usage: bench <what> [mb]"<<C_RESET<<"\n"; return true; }
+                what = lower(what);
+                if(what=="encoding") bench_encoding((size_t)mb);
+                else if(what=="search") bench_search((size_t)mb);
+                else if(what=="regex") bench_regex((size_t)mb);
+                else if(what=="subst") bench_subst((size_t)mb);
+                else if(what=="highlight") bench_highlight((size_t)mb);
+                else cout<<P.warn<<"usage: bench encoding|search|regex|subst|highlight [mb]"<<C_RESET<<"\n";
                 return true;
             }
 
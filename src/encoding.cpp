@@ -0,0 +1,241 @@
+enum class Encoding { Utf8, Utf16LE, Utf16BE, Latin1 };
+
+static string encoding_name(Encoding e, bool bom){
+    string n;
+    switch(e){
+        case Encoding::Utf16LE: n = "utf-16le"; break;
+        case Encoding::Utf16BE: n = "utf-16be"; break;
+        case Encoding::Latin1:  n = "latin-1"; break;
+        default:                n = "utf-8"; break;
+    }
+    if(bom) n += " (bom)";
+    return n;
+}
+
+static bool encoding_from_name(const string& s, Encoding& out, bool& bom){
+    string n = lower(s);
+    n.erase(std::remove(n.begin(), n.end(), '-'), n.end());
+    bom = false;
+    if(n=="utf8"){ out = Encoding::Utf8; return true; }
+    if(n=="utf8bom"){ out = Encoding::Utf8; bom = true; return true; }
+    if(n=="utf16"||n=="utf16le"){ out = Encoding::Utf16LE; bom = true; return true; }
+    if(n=="utf16be"){ out = Encoding::Utf16BE; bom = true; return true; }
+    if(n=="latin1"||n=="iso88591"){ out = Encoding::Latin1; return true; }
+    return false;
+}
+
+static inline char* put_utf8(char* o, uint32_t cp){
+    if(cp < 0x80){ *o++ = (char)cp; }
+    else if(cp < 0x800){
+        *o++ = (char)(0xC0 | (cp>>6));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }else if(cp < 0x10000){
+        *o++ = (char)(0xE0 | (cp>>12));
+        *o++ = (char)(0x80 | ((cp>>6) & 0x3F));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }else{
+        *o++ = (char)(0xF0 | (cp>>18));
+        *o++ = (char)(0x80 | ((cp>>12) & 0x3F));
+        *o++ = (char)(0x80 | ((cp>>6) & 0x3F));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return o;
+}
+
+// Decodes one UTF-8 sequence at p[i]; invalid input yields U+FFFD and
+// consumes a single byte so callers always make progress.
+static inline uint32_t next_utf8(const unsigned char* p, size_t n, size_t& i){
+    unsigned char c = p[i];
+    if(c < 0x80){ i++; return c; }
+    int len = (c>=0xF0 && c<=0xF4)? 4 : (c>=0xE0)? 3 : (c>=0xC2 && c<0xE0)? 2 : 0;
+    if(len==0 || i+(size_t)len > n){ i++; return 0xFFFD; }
+    uint32_t cp = c & (0x7F >> len);
+    for(int k=1;k<len;k++){
+        unsigned char cc = p[i+(size_t)k];
+        if((cc & 0xC0) != 0x80){ i++; return 0xFFFD; }
+        cp = (cp<<6) | (cc & 0x3F);
+    }
+    static const uint32_t min_for[5] = {0, 0, 0x80, 0x800, 0x10000};
+    if(cp < min_for[len] || cp > 0x10FFFF || (cp>=0xD800 && cp<=0xDFFF)){ i++; return 0xFFFD; }
+    i += (size_t)len;
+    return cp;
+}
+
+static size_t ascii_run(const unsigned char* p, size_t n){
+    size_t i = 0;
+#if defined(TEDIT_SSE2)
+    for(; i+16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(p+i));
+        int m = _mm_movemask_epi8(v);
+        if(m) return i + (size_t)__builtin_ctz((unsigned)m);
+    }
+#endif
+    while(i<n && p[i] < 0x80) i++;
+    return i;
+}
+
+static bool utf8_valid(const char* s, size_t n){
+    const unsigned char* p = (const unsigned char*)s;
+    size_t i = 0;
+    while(i < n){
+        i += ascii_run(p+i, n-i);
+        if(i >= n) break;
+        if(next_utf8(p, n, i) == 0xFFFD){
+            if(!(i>=3 && p[i-3]==0xEF && p[i-2]==0xBF && p[i-1]==0xBD)) return false;
+        }
+    }
+    return true;
+}
+
+static Encoding detect_encoding(const char* s, size_t n, size_t& bom_len){
+    const unsigned char* p = (const unsigned char*)s;
+    bom_len = 0;
+    if(n>=3 && p[0]==0xEF && p[1]==0xBB && p[2]==0xBF){ bom_len = 3; return Encoding::Utf8; }
+    if(n>=2 && p[0]==0xFF && p[1]==0xFE){ bom_len = 2; return Encoding::Utf16LE; }
+    if(n>=2 && p[0]==0xFE && p[1]==0xFF){ bom_len = 2; return Encoding::Utf16BE; }
+    size_t sample = std::min<size_t>(n, 4096) & ~(size_t)1;
+    if(sample >= 4){
+        size_t even=0, odd=0;
+        for(size_t i=0;i<sample;i+=2){ if(!p[i]) even++; if(!p[i+1]) odd++; }
+        size_t pairs = sample/2;
+        if(odd*10 >= pairs*3 && even*10 < pairs) return Encoding::Utf16LE;
+        if(even*10 >= pairs*3 && odd*10 < pairs) return Encoding::Utf16BE;
+    }
+    return utf8_valid(s, n)? Encoding::Utf8 : Encoding::Latin1;
+}
+
+static void latin1_to_utf8(const char* s, size_t n, string& out){
+    const unsigned char* p = (const unsigned char*)s;
+    out.resize(n*2);
+    char* o = &out[0];
+    size_t i = 0;
+    while(i < n){
+        size_t run = ascii_run(p+i, n-i);
+        std::memcpy(o, s+i, run);
+        o += run; i += run;
+        if(i >= n) break;
+        o = put_utf8(o, p[i]);
+        i++;
+    }
+    out.resize((size_t)(o - out.data()));
+}
+
+static void utf16_to_utf8(const char* s, size_t n, bool be, string& out){
+    const unsigned char* p = (const unsigned char*)s;
+    out.resize(n/2*3 + 3);
+    char* o = &out[0];
+    size_t i = 0;
+    auto unit = [&](size_t at)->uint32_t{
+        return be? ((uint32_t)p[at]<<8 | p[at+1]) : ((uint32_t)p[at+1]<<8 | p[at]);
+    };
+    while(i+1 < n){
+#if defined(TEDIT_SSE2)
+        const __m128i hi_mask = _mm_set1_epi16((short)0xFF80);
+        const __m128i zero = _mm_setzero_si128();
+        while(i+16 <= n){
+            __m128i v = _mm_loadu_si128((const __m128i*)(p+i));
+            if(be) v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            __m128i test = _mm_cmpeq_epi16(_mm_and_si128(v, hi_mask), zero);
+            if(_mm_movemask_epi8(test) != 0xFFFF) break;
+            _mm_storel_epi64((__m128i*)o, _mm_packus_epi16(v, v));
+            o += 8; i += 16;
+        }
+        if(i+1 >= n) break;
+#endif
+        uint32_t u = unit(i); i += 2;
+        if(u < 0x80){ *o++ = (char)u; continue; }
+        if(u>=0xD800 && u<0xDC00 && i+1<n){
+            uint32_t lo = unit(i);
+            if(lo>=0xDC00 && lo<0xE000){
+                i += 2;
+                o = put_utf8(o, 0x10000 + ((u-0xD800)<<10) + (lo-0xDC00));
+                continue;
+            }
+        }
+        if(u>=0xD800 && u<0xE000) u = 0xFFFD;
+        o = put_utf8(o, u);
+    }
+    if(i < n) o = put_utf8(o, 0xFFFD);
+    out.resize((size_t)(o - out.data()));
+}
+
+static void utf8_to_utf16(const char* s, size_t n, bool be, string& out){
+    const unsigned char* p = (const unsigned char*)s;
+    out.resize(n*2);
+    char* o = &out[0];
+    auto put = [&](uint32_t u){
+        if(be){ *o++ = (char)(u>>8); *o++ = (char)(u & 0xFF); }
+        else  { *o++ = (char)(u & 0xFF); *o++ = (char)(u>>8); }
+    };
+    size_t i = 0;
+    while(i < n){
+#if defined(TEDIT_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        while(i+16 <= n){
+            __m128i v = _mm_loadu_si128((const __m128i*)(p+i));
+            if(_mm_movemask_epi8(v)) break;
+            if(be){
+                _mm_storeu_si128((__m128i*)o,      _mm_unpacklo_epi8(zero, v));
+                _mm_storeu_si128((__m128i*)(o+16), _mm_unpackhi_epi8(zero, v));
+            }else{
+                _mm_storeu_si128((__m128i*)o,      _mm_unpacklo_epi8(v, zero));
+                _mm_storeu_si128((__m128i*)(o+16), _mm_unpackhi_epi8(v, zero));
+            }
+            o += 32; i += 16;
+        }
+        if(i >= n) break;
+#endif
+        uint32_t cp = next_utf8(p, n, i);
+        if(cp >= 0x10000){
+            cp -= 0x10000;
+            put(0xD800 + (cp>>10));
+            put(0xDC00 + (cp & 0x3FF));
+        }else put(cp);
+    }
+    out.resize((size_t)(o - out.data()));
+}
+
+static bool utf8_to_latin1(const char* s, size_t n, string& out){
+    const unsigned char* p = (const unsigned char*)s;
+    out.resize(n);
+    char* o = &out[0];
+    size_t i = 0;
+    while(i < n){
+        size_t run = ascii_run(p+i, n-i);
+        std::memcpy(o, s+i, run);
+        o += run; i += run;
+        if(i >= n) break;
+        uint32_t cp = next_utf8(p, n, i);
+        if(cp > 0xFF) return false;
+        *o++ = (char)cp;
+    }
+    out.resize((size_t)(o - out.data()));
+    return true;
+}
+
+static void decode_to_utf8(const char* p, size_t n, Encoding enc, string& out){
+    switch(enc){
+        case Encoding::Utf16LE: utf16_to_utf8(p, n, false, out); break;
+        case Encoding::Utf16BE: utf16_to_utf8(p, n, true, out); break;
+        case Encoding::Latin1:  latin1_to_utf8(p, n, out); break;
+        default:                out.assign(p, n); break;
+    }
+}
+
+static bool encode_from_utf8(const string& text, Encoding enc, string& out){
+    switch(enc){
+        case Encoding::Utf16LE: utf8_to_utf16(text.data(), text.size(), false, out); return true;
+        case Encoding::Utf16BE: utf8_to_utf16(text.data(), text.size(), true, out); return true;
+        case Encoding::Latin1:  return utf8_to_latin1(text.data(), text.size(), out);
+        default:                out = text; return true;
+    }
+}
+
+static string bom_bytes(Encoding enc){
+    switch(enc){
+        case Encoding::Utf16LE: return string("\xFF\xFE", 2);
+        case Encoding::Utf16BE: return string("\xFE\xFF", 2);
+        case Encoding::Latin1:  return string();
+        default:                return string("\xEF\xBB\xBF", 3);
+    }
+}
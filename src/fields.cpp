@@ -0,0 +1,185 @@
+// Field access for structured log lines without copying. Fields are the
+// runs between spaces and tabs, or the pieces between single delimiter
+// bytes when one is given; key=value pairs are looked up among them. The
+// SSE2 path classifies 16 bytes per step and counts field starts with a
+// popcount, so skipping to field k costs a few instructions per 16 bytes.
+struct FieldSpec{
+    size_t index = 0;       // 1-based field number; 0 when key is used
+    string key;             // matched as "key=" at the start of a field
+    char delim = 0;         // 0: runs of blanks
+};
+
+static inline bool is_field_delim(char c, char delim){
+    return delim? c==delim : (c==' ' || c=='\t');
+}
+
+#if defined(TEDIT_SSE2)
+static inline unsigned field_delim_mask16(const char* p, char delim){
+    __m128i x = _mm_loadu_si128((const __m128i*)p);
+    if(delim) return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(delim)));
+    __m128i sp = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+    __m128i tab = _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(sp, tab));
+}
+#endif
+
+// Start of field k (1-based) in [s, s+n), or null if the line is shorter.
+static const char* field_start(const char* s, size_t n, size_t k, char delim){
+    size_t i = 0;
+    if(delim){
+        size_t need = k - 1;        // field k follows the (k-1)th delimiter
+        if(need == 0) return s;
+#if defined(TEDIT_SSE2)
+        for(; i + 16 <= n; i += 16){
+            unsigned m = field_delim_mask16(s+i, delim);
+            size_t c = (size_t)__builtin_popcount(m);
+            if(c < need){ need -= c; continue; }
+            while(--need) m &= m-1;
+            return s + i + __builtin_ctz(m) + 1;
+        }
+#endif
+        for(; i<n; ++i) if(s[i]==delim && --need==0) return s + i + 1;
+        return nullptr;
+    }
+    unsigned prev = 1;              // a field may start at column 0
+#if defined(TEDIT_SSE2)
+    for(; i + 16 <= n; i += 16){
+        unsigned b = field_delim_mask16(s+i, 0);
+        unsigned starts = ~b & ((b << 1) | prev) & 0xFFFF;
+        size_t c = (size_t)__builtin_popcount(starts);
+        if(c >= k){
+            while(--k) starts &= starts-1;
+            return s + i + __builtin_ctz(starts);
+        }
+        k -= c;
+        prev = b >> 15 & 1;
+    }
+#endif
+    for(; i<n; ++i){
+        bool bl = is_field_delim(s[i], 0);
+        if(!bl && prev && --k == 0) return s + i;
+        prev = bl;
+    }
+    return nullptr;
+}
+
+static const char* field_end(const char* p, const char* e, char delim){
+#if defined(TEDIT_SSE2)
+    for(; p + 16 <= e; p += 16){
+        unsigned m = field_delim_mask16(p, delim);
+        if(m) return p + __builtin_ctz(m);
+    }
+#endif
+    while(p < e && !is_field_delim(*p, delim)) p++;
+    return p;
+}
+
+// Finds the field named by spec in line L; a quoted key="..." value is
+// returned without its quotes.
+static bool field_value(const string& L, const FieldSpec& spec, const LiteralMatcher* keyfind, const char*& out, size_t& len){
+    const char* s = L.data();
+    const char* e = s + L.size();
+    if(spec.index){
+        const char* p = field_start(s, L.size(), spec.index, spec.delim);
+        if(!p) return false;
+        out = p; len = (size_t)(field_end(p, e, spec.delim) - p);
+        return true;
+    }
+    for(const char* p = s; p < e; ){
+        const char* h = keyfind->find(p, (size_t)(e - p));
+        if(!h) return false;
+        if(h == s || is_field_delim(h[-1], spec.delim)){
+            const char* v = h + spec.key.size() + 1;
+            if(v < e && *v == '"'){
+                const char* q = (const char*)std::memchr(v + 1, '"', (size_t)(e - v - 1));
+                if(q){ out = v + 1; len = (size_t)(q - v - 1); return true; }
+            }
+            out = v; len = (size_t)(field_end(v, e, spec.delim) - v);
+            return true;
+        }
+        p = h + 1;
+    }
+    return false;
+}
+
+// Plain decimal numbers only: optional sign, digits, optional fraction.
+static bool parse_field_number(const char* p, size_t n, double& out){
+    size_t i = 0;
+    bool neg = false;
+    if(i < n && (p[i]=='-' || p[i]=='+')) neg = p[i++]=='-';
+    double v = 0, scale = 1;
+    size_t digits = 0;
+    for(; i<n && p[i]>='0' && p[i]<='9'; ++i, ++digits) v = v*10 + (p[i]-'0');
+    if(i < n && p[i]=='.'){
+        for(++i; i<n && p[i]>='0' && p[i]<='9'; ++i, ++digits){ scale /= 10; v += (p[i]-'0')*scale; }
+    }
+    if(!digits || i != n) return false;
+    out = neg? -v : v;
+    return true;
+}
+
+// findf query: = and != compare numerically when both sides are numbers and
+// byte-wise otherwise; < <= > >= need numbers; ~ and !~ test for a
+// substring. Lines without the field never match.
+struct FieldQuery{
+    enum Op{ Eq, Ne, Lt, Le, Gt, Ge, Has, NotHas };
+    FieldSpec spec;
+    Op op = Eq;
+    string value;
+    double num = 0;
+    bool numeric = false;
+    std::unique_ptr<LiteralMatcher> keyfind, sub;
+
+    bool parse(const string& field, const string& opstr, const string& val, char delim, string& err){
+        long n = 0;
+        spec.delim = delim;
+        if(parse_long(field, n)){
+            if(n < 1){ err = "fields are numbered from 1"; return false; }
+            spec.index = (size_t)n;
+        } else {
+            spec.key = field;
+            keyfind.reset(new LiteralMatcher(field + "=", false));
+        }
+        static const std::pair<const char*, Op> ops[] = {
+            {"=", Eq}, {"==", Eq}, {"!=", Ne}, {"<", Lt}, {"<=", Le}, {">", Gt}, {">=", Ge}, {"~", Has}, {"!~", NotHas}
+        };
+        bool found = false;
+        for(auto& o: ops) if(opstr == o.first){ op = o.second; found = true; }
+        if(!found){ err = "unknown operator " + opstr; return false; }
+        value = val;
+        numeric = parse_field_number(val.data(), val.size(), num);
+        if(op>=Lt && op<=Ge && !numeric){ err = "not a number: " + val; return false; }
+        if(op==Has || op==NotHas) sub.reset(new LiteralMatcher(val, false));
+        return true;
+    }
+
+    // A literal every matching line contains, for trigram narrowing.
+    string required() const {
+        string need = spec.key.empty()? string() : spec.key + "=";
+        if((op==Has || (op==Eq && !numeric)) && value.size() > need.size()) need = value;
+        return need;
+    }
+
+    bool matches(const string& L) const {
+        const char* p; size_t n;
+        if(!field_value(L, spec, keyfind.get(), p, n)) return false;
+        switch(op){
+            case Has:    return sub->find(p, n) != nullptr;
+            case NotHas: return sub->find(p, n) == nullptr;
+            default: break;
+        }
+        double x;
+        bool isnum = numeric && parse_field_number(p, n, x);
+        if(op==Eq || op==Ne){
+            bool eq = isnum? x == num : (n == value.size() && std::memcmp(p, value.data(), n) == 0);
+            return eq == (op==Eq);
+        }
+        if(!isnum) return false;
+        switch(op){
+            case Lt: return x < num;
+            case Le: return x <= num;
+            case Gt: return x > num;
+            default: return x >= num;
+        }
+    }
+};
@@ -1,9 +1,63 @@
+static void split_lines(const char* p, size_t n, vector<string>& out){
+    size_t count = 0;
+    for(const char* q = p; (q = (const char*)std::memchr(q, '\n', (size_t)(p + n - q))); ++q) count++;
+    out.reserve(out.size() + count + 1);
+    size_t start = 0;
+    while(start < n){
+        const char* nl = (const char*)std::memchr(p + start, '\n', n - start);
+        size_t end = nl ? (size_t)(nl - p) : n;
+        out.emplace_back(p + start, end - start);
+        rstrip_newline(out.back());
+        start = end + 1;
+    }
+}
+
+static void split_lines(const string& text, vector<string>& out){
+    split_lines(text.data(), text.size(), out);
+}
+
+// Reads the whole file into raw, sized up front from fstat so the bytes are
+// held once (pipes and /proc files, which report no size, grow as read).
+static bool read_file_bytes(const string& path, string& raw){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    size_t got = 0;
+    if(fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size > 0) raw.resize((size_t)st.st_size);
+    for(;;){
+        char tail[65536];
+        bool full = got == raw.size();
+        ssize_t r = full ? ::read(fd, tail, sizeof tail) : ::read(fd, &raw[got], raw.size() - got);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) break;
+        if(full) raw.append(tail, (size_t)r);
+        got += (size_t)r;
+    }
+    ::close(fd);
+    raw.resize(got);
+    return true;
+}
+
+// UTF-8 (the common case) is split straight out of the read buffer; other
+// encodings are decoded first and the raw bytes dropped before splitting.
 static void load_file(const string& path, Buffer& b){
     b.lines.clear();
-    std::ifstream in(path);
-    if(!in.good()){ b.dirty=false; return; }
-    string line;
-    while(std::getline(in,line)){ rstrip_newline(line); b.lines.push_back(line); }
+    b.enc = Encoding::Utf8; b.bom = false;
+    string raw;
+    if(!read_file_bytes(path, raw)){ b.dirty=false; return; }
+    size_t bom_len = 0;
+    b.enc = detect_encoding(raw.data(), raw.size(), bom_len);
+    b.bom = bom_len > 0;
+    const char* p = raw.data() + bom_len;
+    size_t n = raw.size() - bom_len;
+    if(b.enc == Encoding::Utf8){
+        split_lines(p, n, b.lines);
+    }else{
+        string text;
+        decode_to_utf8(p, n, b.enc, text);
+        string().swap(raw);
+        split_lines(text, b.lines);
+    }
     b.dirty=false;
 }
 
@@ -28,12 +82,36 @@ static int fsync_dir_of(const string& path){
 }
 
 
+static bool finish_tmp_file(FILE* tf, string& err);
+
 static bool atomic_save_to_fd(FILE* tf, const Buffer& b, string& err){
-    for(auto& L: b.lines){
-        if(fputs(L.c_str(), tf)==EOF || fputc('\n', tf)==EOF){
+    if(b.enc==Encoding::Utf8 && !b.bom){
+        for(auto& L: b.lines){
+            if(fputs(L.c_str(), tf)==EOF || fputc('\n', tf)==EOF){
+                err=string("write: ")+strerror(errno); fclose(tf); return false;
+            }
+        }
+    }else{
+        string out, line;
+        if(b.bom) out = bom_bytes(b.enc);
+        if(!out.empty() && fwrite(out.data(), 1, out.size(), tf)!=out.size()){
             err=string("write: ")+strerror(errno); fclose(tf); return false;
         }
+        for(size_t i=0;i<b.lines.size();++i){
+            line.assign(b.lines[i]).push_back('\n');
+            if(!encode_from_utf8(line, b.enc, out)){
+                err="encode: line "+std::to_string(i+1)+" has characters outside "+encoding_name(b.enc,false);
+                fclose(tf); return false;
+            }
+            if(fwrite(out.data(), 1, out.size(), tf)!=out.size()){
+                err=string("write: ")+strerror(errno); fclose(tf); return false;
+            }
+        }
     }
+    return finish_tmp_file(tf, err);
+}
+
+static bool finish_tmp_file(FILE* tf, string& err){
     if(fflush(tf)!=0){
         err=string("flush: ")+strerror(errno); fclose(tf); return false;
     }
@@ -59,8 +137,8 @@ static bool doas_move_into_place_secure(const string& tmp, const string& dest, s
 }
 
 
-static bool atomic_save(const string& path, const Buffer& b, bool backup, string& err){
-    mode_t mode = 0644; struct stat st{};
+static bool atomic_save_with(const string& path, bool backup, const std::function<bool(FILE*, string&)>& fill, string& err, mode_t new_mode = 0644){
+    mode_t mode = new_mode; struct stat st{};
     if(::stat(path.c_str(), &st)==0) mode = st.st_mode & 0777;
 
     if(backup && ::stat(path.c_str(), &st)==0){
@@ -81,7 +159,7 @@ static bool atomic_save(const string& path, const Buffer& b, bool backup, string
         unlink(tbuf.data());
         return false;
     }
-    if(!atomic_save_to_fd(tf,b,err)){
+    if(!fill(tf,err)){
         unlink(tbuf.data());
         return false;
     }
@@ -100,6 +178,10 @@ static bool atomic_save(const string& path, const Buffer& b, bool backup, string
     return true;
 }
 
+static bool atomic_save(const string& path, const Buffer& b, bool backup, string& err){
+    return atomic_save_with(path, backup, [&](FILE* tf, string& e){ return atomic_save_to_fd(tf, b, e); }, err);
+}
+
 
 
 
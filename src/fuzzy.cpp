@@ -0,0 +1,118 @@
+// Fuzzy line finder. A line matches when the query's bytes occur in it in
+// order. Each query byte is located with a vectorised, case-folded byte
+// search, which rejects most lines after a few probes; survivors get the
+// shortest window that still contains the query, scored in one pass:
+// consecutive runs and word starts earn bonuses, gaps cost. Only the
+// first FUZZY_MAX_LINE bytes of a line are considered, so scoring is
+// bounded. Every chunk keeps its own top-K heap; the heaps are merged.
+static const size_t FUZZY_MAX_LINE = 4096;
+
+struct FuzzyHit{ long score; size_t len, line; };
+
+static bool fuzzy_better(const FuzzyHit& a, const FuzzyHit& b){
+    if(a.score != b.score) return a.score > b.score;
+    if(a.len != b.len) return a.len < b.len;
+    return a.line < b.line;
+}
+
+// First byte in [p, e) equal to c; with icase, c must be folded.
+static const char* find_byte_folded(const char* p, const char* e, unsigned char c, bool icase){
+    if(p >= e) return nullptr;
+    if(!icase || c < 'a' || c > 'z') return (const char*)std::memchr(p, c, (size_t)(e - p));
+#if defined(TEDIT_SSE2)
+    const __m128i needle = _mm_set1_epi8((char)c);
+    for(; p + 16 <= e; p += 16){
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(fold_ascii16(_mm_loadu_si128((const __m128i*)p)), needle));
+        if(m) return p + __builtin_ctz(m);
+    }
+#endif
+    for(; p < e; ++p) if(fold_ascii((unsigned char)*p) == c) return p;
+    return nullptr;
+}
+
+struct FuzzyQuery{
+    string q;                   // folded when icase
+    bool icase = true;
+
+    // Smart case: the query is case-sensitive only if it has capitals.
+    explicit FuzzyQuery(const string& query): q(query) {
+        for(char c: q) if(c>='A' && c<='Z') icase = false;
+    }
+
+    unsigned char at(const char* p) const { return icase? fold_ascii((unsigned char)*p) : (unsigned char)*p; }
+
+    // Scores L, returning false unless q is a subsequence of it. pos gets the
+    // offsets of the matched bytes when given.
+    bool score(const string& L, long& out, vector<size_t>* pos) const {
+        const char* s = L.data();
+        const char* e = s + std::min(L.size(), FUZZY_MAX_LINE);
+        const char* p = s;
+        for(char c: q){
+            const char* h = find_byte_folded(p, e, (unsigned char)c, icase);
+            if(!h) return false;
+            p = h + 1;
+        }
+        // Walk back from the earliest end for the latest start: the
+        // shortest window ending there.
+        const char* b = p;
+        for(size_t k=q.size(); k-- > 0;){
+            do b--; while(at(b) != (unsigned char)q[k]);
+        }
+        long sc = 0;
+        const char* prev = nullptr;
+        size_t k = 0;
+        for(const char* c = b; c < p && k < q.size(); ++c){
+            if(at(c) != (unsigned char)q[k]) continue;
+            sc += 16;
+            unsigned char before = c > s? (unsigned char)c[-1] : ' ';
+            if(!std::isalnum(before)) sc += 10;
+            else if(std::islower(before) && std::isupper((unsigned char)*c)) sc += 8;
+            if(prev){
+                size_t gap = (size_t)(c - prev) - 1;
+                if(gap == 0) sc += 12;
+                else sc -= 3 + (long)std::min<size_t>(gap - 1, 20);
+            }
+            if(pos) pos->push_back((size_t)(c - s));
+            prev = c;
+            k++;
+        }
+        out = sc;
+        return true;
+    }
+};
+
+// Best k lines for q in ranked order.
+static void fuzzy_top(const vector<string>& lines, const FuzzyQuery& fq, size_t k, vector<FuzzyHit>& out, size_t& matched){
+    out.clear(); matched = 0;
+    if(k == 0 || fq.q.empty()) return;
+    auto run = [&](size_t a, size_t b, vector<FuzzyHit>& heap, size_t& count){
+        for(size_t i=a;i<b;++i){
+            long sc;
+            if(!fq.score(lines[i], sc, nullptr)) continue;
+            count++;
+            FuzzyHit h{sc, lines[i].size(), i+1};
+            if(heap.size() < k){ heap.push_back(h); std::push_heap(heap.begin(), heap.end(), fuzzy_better); }
+            else if(fuzzy_better(h, heap.front())){
+                std::pop_heap(heap.begin(), heap.end(), fuzzy_better);
+                heap.back() = h;
+                std::push_heap(heap.begin(), heap.end(), fuzzy_better);
+            }
+        }
+    };
+    size_t n = lines.size();
+    WorkerPool& pool = WorkerPool::get();
+    if(n < PAR_MIN_LINES || pool.size() <= 1) run(0, n, out, matched);
+    else {
+        size_t chunk = std::max(PAR_CHUNK_LINES, n / (pool.size() * 8) + 1);
+        size_t tasks = (n + chunk - 1) / chunk;
+        vector<vector<FuzzyHit>> heaps(tasks);
+        vector<size_t> counts(tasks, 0);
+        pool.run(tasks, [&](size_t t){ run(t*chunk, std::min(n, (t+1)*chunk), heaps[t], counts[t]); });
+        for(size_t t=0;t<tasks;++t){
+            out.insert(out.end(), heaps[t].begin(), heaps[t].end());
+            matched += counts[t];
+        }
+    }
+    std::sort(out.begin(), out.end(), fuzzy_better);
+    if(out.size() > k) out.resize(k);
+}
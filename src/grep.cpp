@@ -0,0 +1,129 @@
+// Recursive grep over a directory tree. Each directory level is listed on
+// the worker pool, then its files are mapped and scanned in parallel; every
+// file's hits are printed as one block as soon as that file is done.
+// Hidden entries, binary files (a NUL in the first 8 KB) and paths matched
+// by .gitignore / .teditignore rules are skipped.
+static const size_t GREP_SHOW_MAX = 240;
+
+struct IgnoreRule{ string base, pat; bool dir_only, anchored; };
+typedef std::shared_ptr<const vector<IgnoreRule>> IgnoreRules;
+
+// Reads the simple subset of gitignore syntax: globs, trailing '/' for
+// directories, and '/' anchoring. Negated rules are ignored.
+static IgnoreRules read_ignore_rules(const string& dir, const string& rel, const IgnoreRules& parent){
+    vector<IgnoreRule> own;
+    for(const char* name: {".gitignore", ".teditignore"}){
+        std::ifstream in(dir + "/" + name);
+        string L;
+        while(std::getline(in, L)){
+            rstrip_newline(L);
+            L = trim_copy(L);
+            if(L.empty() || L[0]=='#' || L[0]=='!') continue;
+            IgnoreRule r{rel, L, false, false};
+            if(r.pat.back()=='/'){ r.dir_only = true; r.pat.pop_back(); }
+            if(!r.pat.empty() && r.pat[0]=='/'){ r.anchored = true; r.pat.erase(0, 1); }
+            else if(r.pat.find('/') != string::npos) r.anchored = true;
+            if(!r.pat.empty()) own.push_back(r);
+        }
+    }
+    if(own.empty()) return parent;
+    auto all = std::make_shared<vector<IgnoreRule>>(*parent);
+    all->insert(all->end(), own.begin(), own.end());
+    return all;
+}
+
+static bool ignored(const IgnoreRules& rules, const string& rel, const string& name, bool is_dir){
+    if(is_dir && (name==".git" || name==".hg" || name==".svn" || name=="node_modules")) return true;
+    for(const auto& r: *rules){
+        if(r.dir_only && !is_dir) continue;
+        if(!r.anchored){
+            if(fnmatch(r.pat.c_str(), name.c_str(), 0)==0) return true;
+            continue;
+        }
+        if(rel.compare(0, r.base.size(), r.base)!=0) continue;
+        string sub = rel.substr(r.base.empty()? 0 : r.base.size() + 1);
+        if(fnmatch(r.pat.c_str(), sub.c_str(), FNM_PATHNAME)==0) return true;
+    }
+    return false;
+}
+
+struct GrepHit{ string path; size_t line; };
+
+struct GrepStats{ size_t files = 0, skipped = 0, hits = 0; };
+
+// test(p, n) says whether the line [p, p+n) matches. When given, pre finds
+// a literal every matching line contains, so files are skipped through with
+// the SIMD matcher instead of line by line.
+template<class Test>
+static void grep_tree(const string& root, bool hidden, const LiteralMatcher* pre, const Test& test,
+                      const ThemePalette& P, vector<GrepHit>& hits, GrepStats& stats){
+    std::mutex out_m;
+    auto scan = [&](const string& path){
+        MappedFile mf; string err;
+        bool binary = !mf.open(path, err) || (mf.size && std::memchr(mf.data, 0, std::min<size_t>(mf.size, 8192)));
+        if(binary){ std::lock_guard<std::mutex> lk(out_m); stats.skipped++; return; }
+        vector<std::pair<size_t, string>> found;
+        const char* p = (const char*)mf.data;
+        const char* e = p + mf.size;
+        size_t ln = 1;
+        while(p < e){
+            if(pre){
+                const char* h = pre->find(p, (size_t)(e - p));
+                if(!h) break;
+                for(const char* q; (q = (const char*)std::memchr(p, '\n', (size_t)(h - p))); ln++) p = q + 1;
+            }
+            const char* nl = (const char*)std::memchr(p, '\n', (size_t)(e - p));
+            const char* le = nl? nl : e;
+            size_t n = (size_t)(le - p);
+            if(n && le[-1]=='\r') n--;
+            if(test(p, n)) found.push_back({ln, string(p, std::min(n, GREP_SHOW_MAX)) + (n > GREP_SHOW_MAX? "..." : "")});
+            p = le + 1; ln++;
+        }
+        std::lock_guard<std::mutex> lk(out_m);
+        stats.files++;
+        for(auto& h: found){
+            hits.push_back(GrepHit{path, h.first});
+            cout<<P.dim<<"["<<hits.size()<<"]"<<C_RESET<<" "<<path<<":"<<h.first<<": "<<h.second<<"\n";
+        }
+        if(!found.empty()) cout<<std::flush;
+    };
+    std::error_code ec;
+    if(!fs::is_directory(root, ec)){ scan(root); stats.hits = hits.size(); return; }
+
+    struct Dir{ string path, rel; IgnoreRules rules; };
+    vector<Dir> level{ Dir{root, "", read_ignore_rules(root, "", std::make_shared<vector<IgnoreRule>>())} };
+    WorkerPool& pool = WorkerPool::get();
+    while(!level.empty()){
+        vector<vector<Dir>> subdirs(level.size());
+        vector<vector<string>> files(level.size());
+        pool.run(level.size(), [&](size_t d){
+            const Dir& D = level[d];
+            std::error_code ec1;
+            fs::directory_iterator it(D.path, fs::directory_options::skip_permission_denied, ec1), end;
+            for(; !ec1 && it!=end; it.increment(ec1)){
+                string name = it->path().filename().string();
+                if(!hidden && !name.empty() && name[0]=='.') continue;
+                std::error_code ec2;
+                if(it->is_symlink(ec2)) continue;
+                bool dir = it->is_directory(ec2);
+                if(!dir && !it->is_regular_file(ec2)) continue;
+                string rel = D.rel.empty()? name : D.rel + "/" + name;
+                if(ignored(D.rules, rel, name, dir)) continue;
+                string full = D.path=="."? name : D.path + "/" + name;
+                if(dir) subdirs[d].push_back(Dir{full, rel, read_ignore_rules(full, rel, D.rules)});
+                else files[d].push_back(full);
+            }
+            std::sort(files[d].begin(), files[d].end());
+        });
+        vector<string> todo;
+        for(auto& f: files) todo.insert(todo.end(), f.begin(), f.end());
+        pool.run(todo.size(), [&](size_t t){ scan(todo[t]); });
+        vector<Dir> next;
+        for(auto& sd: subdirs){
+            std::sort(sd.begin(), sd.end(), [](const Dir& x, const Dir& y){ return x.path < y.path; });
+            for(auto& d: sd) next.push_back(std::move(d));
+        }
+        level.swap(next);
+    }
+    stats.hits = hits.size();
+}
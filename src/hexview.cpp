@@ -0,0 +1,114 @@
+struct HexView{
+    string path;
+    unsigned char* data = nullptr;
+    size_t size = 0;
+    size_t patched = 0;
+    size_t cursor = 0;
+    string last_pattern;
+
+    HexView() = default;
+    HexView(const HexView&) = delete;
+    HexView& operator=(const HexView&) = delete;
+    ~HexView(){ close(); }
+
+    bool active() const { return !path.empty(); }
+    bool dirty() const { return patched > 0; }
+
+    bool open(const string& p, string& err){
+        close();
+        int fd = ::open(p.c_str(), O_RDONLY);
+        if(fd < 0){ err = string(std::strerror(errno)); return false; }
+        struct stat st{};
+        if(fstat(fd, &st) < 0){ err = string(std::strerror(errno)); ::close(fd); return false; }
+        if(!S_ISREG(st.st_mode)){ err = "not a regular file"; ::close(fd); return false; }
+        size = (size_t)st.st_size;
+        if(size > 0){
+            void* m = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if(m == MAP_FAILED){ err = "mmap: " + string(std::strerror(errno)); ::close(fd); size = 0; return false; }
+            data = (unsigned char*)m;
+        }
+        ::close(fd);
+        path = p;
+        patched = 0;
+        cursor = 0;
+        return true;
+    }
+
+    void close(){
+        if(data) munmap(data, size);
+        data = nullptr; size = 0; patched = 0; cursor = 0;
+        path.clear(); last_pattern.clear();
+    }
+
+    bool patch(size_t off, const string& bytes, string& err){
+        if(off > size || bytes.size() > size - off){ err = "patch past end of file"; return false; }
+        for(size_t i=0;i<bytes.size();++i){
+            if(data[off+i] != (unsigned char)bytes[i]){ data[off+i] = (unsigned char)bytes[i]; patched++; }
+        }
+        return true;
+    }
+
+    bool save(const string& target, bool backup, string& err){
+        bool ok = atomic_save_with(target, backup, [&](FILE* tf, string& e){
+            if(size && fwrite(data, 1, size, tf) != size){
+                e = string("write: ") + strerror(errno); fclose(tf); return false;
+            }
+            return finish_tmp_file(tf, e);
+        }, err);
+        if(ok){ path = target; patched = 0; }
+        return ok;
+    }
+
+    size_t find(const string& pat, size_t from) const {
+        if(!data || from >= size) return string::npos;
+        const unsigned char* hit = find_bytes(data+from, size-from, (const unsigned char*)pat.data(), pat.size());
+        return hit ? (size_t)(hit - data) : string::npos;
+    }
+
+    void dump(size_t off, size_t len, const ThemePalette& P) const {
+        if(off >= size){ cout<<"(offset past end of file)\n"; return; }
+        size_t end = (len > size - off) ? size : off + len;
+        char tmp[8];
+        for(size_t row = off - off % 16; row < end; row += 16){
+            std::ostringstream line;
+            line<<P.gutter<<std::hex<<std::setw(10)<<std::setfill('0')<<row<<std::dec<<std::setfill(' ')<<C_RESET<<"  ";
+            string ascii;
+            for(size_t k=0;k<16;++k){
+                size_t at = row + k;
+                if(k==8) line<<" ";
+                if(at < off || at >= end){ line<<"   "; ascii.push_back(' '); continue; }
+                unsigned char c = data[at];
+                std::snprintf(tmp, sizeof(tmp), "%02x ", c);
+                line<<tmp;
+                ascii.push_back((c>=0x20 && c<0x7f)? (char)c : '.');
+            }
+            cout<<line.str()<<" "<<P.dim<<"|"<<C_RESET<<ascii<<P.dim<<"|"<<C_RESET<<"\n";
+        }
+    }
+};
+
+static bool looks_binary_file(const string& path){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    unsigned char head[8192];
+    ssize_t r = ::read(fd, head, sizeof(head));
+    ::close(fd);
+    if(r <= 0) return false;
+    size_t bom = 0;
+    Encoding e = detect_encoding((const char*)head, (size_t)r, bom);
+    if(e==Encoding::Utf16LE || e==Encoding::Utf16BE) return false;
+    return std::memchr(head, 0, (size_t)r) != nullptr;
+}
+
+// Decimal, or hex with a 0x prefix; a leading 0 does not mean octal.
+static bool parse_offset(const string& s, size_t& out){
+    bool hex = s.size() > 2 && s[0]=='0' && (s[1]=='x' || s[1]=='X');
+    const char* p = s.c_str() + (hex ? 2 : 0);
+    if(hex ? !std::isxdigit((unsigned char)*p) : !std::isdigit((unsigned char)*p)) return false;
+    errno = 0;
+    char* e = nullptr;
+    unsigned long long v = std::strtoull(p, &e, hex ? 16 : 10);
+    if(errno == ERANGE || *e) return false;
+    out = (size_t)v;
+    return true;
+}
@@ -1,6 +1,311 @@
 enum class Lang { Plain, Cpp, Python, Shell, Ruby, JS, HTML, CSS, JSON };
 
+// Highlighting is one left-to-right pass per line driven by a LangSpec
+// table: the lexer emits spans, and render_spans() wraps each in its
+// palette colour in a single append. Text inside a span is never looked
+// at again, so a "//" in a string or a keyword in a comment stays put.
+// Block comments and multi-line strings carry over to the next line as a
+// small HlState; HlMarks keeps those states at checkpoints down the file.
+enum class HlKind : uint8_t { String, Comment, Keyword, Var, Tag, Prop, Punct };
+
+struct HlSpan{ uint32_t start, len; HlKind kind; };
+
+typedef uint8_t HlState;    // 0: code, 1: block comment, 2+k: inside ml_strings[k]
+
+struct MlString{ string open, close; };
+
+// Keyword sets as hash tables whose seed is searched for at compile time
+// until every keyword lands in its own slot, so a lookup is a length-mask
+// test, one short hash and one string compare. The same builder runs at
+// run time for lists that are not known in advance; if no collision-free
+// seed turns up there, the table falls back to linear probing.
+static const size_t KW_SLOTS = 512;
+static const size_t KW_MAX = 255;
+
+struct KeywordTable{
+    const char* const* words = nullptr;
+    size_t count = 0;
+    uint64_t seed = 0;
+    uint32_t len_mask = 0;          // bit n set when some keyword is n bytes long
+    size_t probes = 0;              // longest probe run; 1 when the hash is perfect
+    uint8_t slot[KW_SLOTS] = {};    // 1 + index into words, 0 when empty
+
+    static constexpr size_t hash(const char* p, size_t n, uint64_t seed){
+        uint64_t h = seed ^ n;
+        for(size_t i=0;i<n;++i) h = (h + (unsigned char)p[i]) * 0x9E3779B97F4A7C15ull;
+        return (size_t)(h >> 55);   // top 9 bits: KW_SLOTS
+    }
+
+    bool has(const char* p, size_t n) const {
+        if(n >= 32 || !(len_mask >> n & 1)) return false;
+        size_t h = hash(p, n, seed);
+        for(size_t k=0; k<probes; ++k, h = (h + 1) & (KW_SLOTS - 1)){
+            uint8_t w = slot[h];
+            if(!w) return false;
+            const char* kw = words[w - 1];
+            if(std::strncmp(kw, p, n) == 0 && kw[n] == 0) return true;
+        }
+        return false;
+    }
+};
+
+static constexpr size_t kw_length(const char* w){ size_t n = 0; while(w[n]) n++; return n; }
+
+// words must outlive the table and hold at most KW_MAX distinct entries
+// shorter than 32 bytes.
+static constexpr KeywordTable build_keyword_table(const char* const* words, size_t count){
+    KeywordTable t;
+    t.words = words; t.count = count;
+    for(size_t i=0;i<count;++i) t.len_mask |= 1u << kw_length(words[i]);
+    for(uint64_t seed=1; seed<=4096; ++seed){
+        for(size_t k=0;k<KW_SLOTS;++k) t.slot[k] = 0;
+        bool ok = true;
+        for(size_t i=0; i<count && ok; ++i){
+            size_t h = KeywordTable::hash(words[i], kw_length(words[i]), seed);
+            if(t.slot[h]) ok = false;
+            else t.slot[h] = (uint8_t)(i + 1);
+        }
+        if(ok){ t.seed = seed; t.probes = 1; return t; }
+    }
+    for(size_t k=0;k<KW_SLOTS;++k) t.slot[k] = 0;
+    t.seed = 1; t.probes = 1;
+    for(size_t i=0;i<count;++i){
+        size_t h = KeywordTable::hash(words[i], kw_length(words[i]), t.seed), run = 1;
+        for(; t.slot[h]; h = (h + 1) & (KW_SLOTS - 1)) run++;
+        t.slot[h] = (uint8_t)(i + 1);
+        if(run > t.probes) t.probes = run;
+    }
+    return t;
+}
+
+template<size_t N>
+static constexpr KeywordTable keyword_table(const char* const (&words)[N]){
+    static_assert(N <= KW_MAX, "too many keywords for one table");
+    return build_keyword_table(words, N);
+}
+
+// Adding a language's keywords is one list and one table line here.
+static constexpr const char* CPP_KEYWORDS[] = {
+    "auto","break","case","class","const","continue","default","delete","do","else","enum","for","friend","if",
+    "inline","namespace","new","noexcept","operator","private","protected","public","return","sizeof","static",
+    "struct","switch","template","this","throw","try","typedef","typename","union","using","virtual","void",
+    "volatile","while"};
+static constexpr const char* PYTHON_KEYWORDS[] = {
+    "False","True","None","def","class","return","import","from","if","else","elif","for","while","try","except",
+    "finally","with","as","lambda","pass","yield","raise","global","nonlocal","assert","async","await","in","is",
+    "and","or","not"};
+static constexpr const char* SHELL_KEYWORDS[] = {
+    "if","then","else","elif","fi","for","in","do","done","case","esac","function","select","until","time","echo",
+    "exit","return"};
+static constexpr const char* RUBY_KEYWORDS[] = {
+    "def","class","module","if","else","elsif","end","do","while","until","return","yield","begin","rescue",
+    "ensure","case","when","then","super","self","nil","true","false"};
+static constexpr const char* JS_KEYWORDS[] = {
+    "function","return","let","const","var","if","else","for","while","class","extends","import","export","new",
+    "try","catch","finally","throw","switch","case","default","break","continue","yield","await","async","true",
+    "false","null","undefined","NaN","Infinity"};
+static constexpr const char* JSON_KEYWORDS[] = {"true","false","null"};
+
+static constexpr KeywordTable CPP_KW = keyword_table(CPP_KEYWORDS);
+static constexpr KeywordTable PYTHON_KW = keyword_table(PYTHON_KEYWORDS);
+static constexpr KeywordTable SHELL_KW = keyword_table(SHELL_KEYWORDS);
+static constexpr KeywordTable RUBY_KW = keyword_table(RUBY_KEYWORDS);
+static constexpr KeywordTable JS_KW = keyword_table(JS_KEYWORDS);
+static constexpr KeywordTable JSON_KW = keyword_table(JSON_KEYWORDS);
+static_assert(CPP_KW.probes == 1 && PYTHON_KW.probes == 1 && SHELL_KW.probes == 1 &&
+              RUBY_KW.probes == 1 && JS_KW.probes == 1 && JSON_KW.probes == 1, "keyword hash is not perfect");
+
+enum : uint8_t { HL_WORD = 1, HL_QUOTE = 2, HL_PUNCT = 4, HL_START = 8 };
+
+struct LangSpec{
+    const char* line_comment = nullptr;
+    const char* block_open = nullptr;
+    const char* block_close = nullptr;
+    const char* quotes = "";            // string delimiters; backslash escapes
+    const char* word_extra = "";        // word bytes besides [A-Za-z0-9_]
+    const char* punct = "";             // bytes painted as punctuation
+    bool comment_after_blank = false;   // line comment only at start or after a blank
+    bool vars = false;                  // $name and ${...}
+    bool tags = false;                  // <...>
+    bool props = false;                 // a word followed by ':' is a property
+    vector<MlString> ml_strings;        // strings that may span lines
+    const KeywordTable* keywords = nullptr;
+    uint8_t cls[256] = {};              // HL_* bits per byte, from finalize()
+
+    void finalize(){
+        std::memset(cls, 0, sizeof cls);
+        for(int c=0;c<256;++c) if(std::isalnum(c) || c=='_') cls[c] |= HL_WORD;
+        for(const char* p = word_extra; *p; ++p) cls[(unsigned char)*p] |= HL_WORD;
+        for(const char* p = quotes; *p; ++p) cls[(unsigned char)*p] |= HL_QUOTE;
+        for(const char* p = punct; *p; ++p) cls[(unsigned char)*p] |= HL_PUNCT;
+        for(const char* t: {line_comment, block_open}) if(t && *t) cls[(unsigned char)*t] |= HL_START;
+        if(vars) cls['$'] |= HL_START;
+        if(tags) cls['<'] |= HL_START;
+        for(auto& d: ml_strings) cls[(unsigned char)d.open[0]] |= HL_START;
+    }
+
+    bool stateful() const { return block_open || !ml_strings.empty(); }
+};
+
+static LangSpec make_lang_spec(Lang lang){
+    LangSpec s;
+    switch(lang){
+        case Lang::Plain:
+        case Lang::Cpp:
+            s.line_comment = "//"; s.quotes = "\"";
+            if(lang == Lang::Cpp){ s.block_open = "/*"; s.block_close = "*/"; }
+            s.keywords = &CPP_KW;
+            break;
+        case Lang::Python:
+            s.line_comment = "#"; s.quotes = "\"'"; s.ml_strings = {{"\"\"\"", "\"\"\""}, {"'''", "'''"}};
+            s.keywords = &PYTHON_KW;
+            break;
+        case Lang::Shell:
+            s.line_comment = "#"; s.quotes = "\"'"; s.comment_after_blank = true; s.vars = true;
+            s.keywords = &SHELL_KW;
+            break;
+        case Lang::Ruby:
+            s.line_comment = "#"; s.quotes = "\"'";
+            s.keywords = &RUBY_KW;
+            break;
+        case Lang::JS:
+            s.line_comment = "//"; s.block_open = "/*"; s.block_close = "*/"; s.quotes = "\"'"; s.ml_strings = {{"`", "`"}};
+            s.keywords = &JS_KW;
+            break;
+        case Lang::HTML:
+            s.block_open = "<!--"; s.block_close = "-->"; s.tags = true;
+            break;
+        case Lang::CSS:
+            s.block_open = "/*"; s.block_close = "*/"; s.word_extra = "-"; s.punct = "{};:,"; s.props = true;
+            break;
+        case Lang::JSON:
+            s.quotes = "\"";
+            s.keywords = &JSON_KW;
+            break;
+    }
+    s.finalize();
+    return s;
+}
+
+// Grammars declared from Lua, either by tedit_grammar{...} or by a file in
+// the grammars directory returning such a table, are compiled here into
+// the same LangSpec and KeywordTable the built-in languages use, so
+// highlighting never calls into Lua. Each takes a Lang value past the
+// built-ins; a name that is loaded again keeps its value.
+static const int LANG_BUILTIN = (int)Lang::JSON + 1;
+
+struct Grammar{
+    string name;
+    vector<string> extensions;      // ".ext", or a whole file name
+    vector<string> keywords;
+    string line_comment, block_open, block_close;
+    string quotes, word_extra, punct;
+    vector<MlString> ml_strings;
+    bool comment_after_blank = false, vars = false, tags = false, props = false;
+
+    vector<const char*> kw_words;   // into keywords; backs kw
+    KeywordTable kw;
+    LangSpec spec;
+    bool live = true;
+    bool from_file = false;         // loaded from the grammars directory
+};
+
+static bool compile_grammar(Grammar& g, string& err){
+    g.name = lower(trim_copy(g.name));
+    if(g.name.empty()){ err = "name is required"; return false; }
+    if(g.block_open.empty() != g.block_close.empty()){ err = "block_comment needs an opening and a closing delimiter"; return false; }
+    if(g.ml_strings.size() > 32){ err = "at most 32 multiline_strings"; return false; }
+    for(auto& d: g.ml_strings) if(d.open.empty() || d.close.empty()){ err = "multiline_strings delimiters must not be empty"; return false; }
+    std::sort(g.keywords.begin(), g.keywords.end());
+    g.keywords.erase(std::unique(g.keywords.begin(), g.keywords.end()), g.keywords.end());
+    if(g.keywords.size() > KW_MAX){ err = "at most " + std::to_string(KW_MAX) + " keywords"; return false; }
+    for(auto& w: g.keywords) if(w.empty() || w.size() >= 32){ err = "keywords must be 1 to 31 bytes: " + w; return false; }
+    g.kw_words.clear();
+    for(auto& w: g.keywords) g.kw_words.push_back(w.c_str());
+    g.kw = build_keyword_table(g.kw_words.data(), g.kw_words.size());
+
+    LangSpec& s = g.spec;
+    s = LangSpec();
+    if(!g.line_comment.empty()) s.line_comment = g.line_comment.c_str();
+    if(!g.block_open.empty()){ s.block_open = g.block_open.c_str(); s.block_close = g.block_close.c_str(); }
+    s.quotes = g.quotes.c_str();
+    s.word_extra = g.word_extra.c_str();
+    s.punct = g.punct.c_str();
+    s.ml_strings = g.ml_strings;
+    s.comment_after_blank = g.comment_after_blank;
+    s.vars = g.vars; s.tags = g.tags; s.props = g.props;
+    if(!g.keywords.empty()) s.keywords = &g.kw;
+    s.finalize();
+    return true;
+}
+
+struct GrammarRegistry{
+    vector<std::unique_ptr<Grammar>> slots;     // slot k is Lang(LANG_BUILTIN + k)
+
+    bool add(std::unique_ptr<Grammar> g, string& err){
+        if(!compile_grammar(*g, err)) return false;
+        for(auto& s: slots) if(s->name == g->name){ s = std::move(g); return true; }
+        if(slots.size() >= 256 - (size_t)LANG_BUILTIN){ err = "too many grammars"; return false; }
+        slots.push_back(std::move(g));
+        return true;
+    }
+
+    // Retires the grammars loaded from the grammars directory before it is
+    // read again; ones registered by a plugin stay. Slots keep their
+    // numbers, so a grammar reloaded under the same name maps to the same
+    // Lang.
+    void clear_files(){ for(auto& s: slots) if(s->from_file) s->live = false; }
+
+    const Grammar* get(Lang lang) const {
+        int k = (int)lang - LANG_BUILTIN;
+        if(k < 0 || (size_t)k >= slots.size() || !slots[(size_t)k]->live) return nullptr;
+        return slots[(size_t)k].get();
+    }
+
+    bool by_name(const string& name, Lang& out) const {
+        string n = lower(name);
+        for(size_t k=0;k<slots.size();++k)
+            if(slots[k]->live && slots[k]->name == n){ out = (Lang)(LANG_BUILTIN + (int)k); return true; }
+        return false;
+    }
+
+    bool by_path(const string& path, Lang& out) const {
+        fs::path p(path);
+        string file = p.filename().string(), ext = lower(p.extension().string());
+        for(size_t k=0;k<slots.size();++k){
+            if(!slots[k]->live) continue;
+            for(auto& e: slots[k]->extensions){
+                if(e.empty()) continue;
+                if(e[0]=='.' ? lower(e)==ext : e==file){ out = (Lang)(LANG_BUILTIN + (int)k); return true; }
+            }
+        }
+        return false;
+    }
+
+    size_t live_count() const {
+        size_t n = 0;
+        for(auto& s: slots) n += s->live;
+        return n;
+    }
+};
+
+static GrammarRegistry& grammars(){ static GrammarRegistry r; return r; }
+
+static const LangSpec& lang_spec(Lang lang){
+    static const vector<LangSpec> specs = []{
+        vector<LangSpec> v;
+        for(int k=0; k<=(int)Lang::JSON; ++k) v.push_back(make_lang_spec((Lang)k));
+        return v;
+    }();
+    if((int)lang < LANG_BUILTIN) return specs[(size_t)lang];
+    const Grammar* g = grammars().get(lang);
+    return g? g->spec : specs[(size_t)Lang::Plain];
+}
+
+// Declared grammars win over the built-in extension table.
 static Lang detect_lang(const string& path){
+    Lang custom;
+    if(grammars().by_path(path, custom)) return custom;
     string ext = lower(fs::path(path).extension().string());
     if(ext==".c"||ext==".cc"||ext==".cpp"||ext==".cxx"||ext==".h"||ext==".hh"||ext==".hpp") return Lang::Cpp;
     if(ext==".py") return Lang::Python;
@@ -13,68 +318,397 @@ static Lang detect_lang(const string& path){
     return Lang::Plain;
 }
 
-static string colorize(const string& L, const Buffer& b, const ThemePalette& P){
-    if(!use_color() || !b.highlight) return L;
-    string s=L;
-    try{
-        s = std::regex_replace(s, std::regex(R"("([^"\\]|\\.)*")"), P.accent+"$&"+C_RESET);
-        s = std::regex_replace(s, std::regex(R"(//.*$)"), P.dim+"$&"+C_RESET);
-        s = std::regex_replace(s, std::regex(R"(\b(auto|break|case|class|const|continue|default|delete|do|else|enum|for|friend|if|inline|namespace|new|noexcept|operator|private|protected|public|return|sizeof|static|struct|switch|template|this|throw|try|typedef|typename|union|using|virtual|void|volatile|while)\b)"), P.ok+"$&"+C_RESET);
-    }catch(...){}
-    return s;
+// Reads the grammar table at stack index t into g. Fields: name,
+// extensions, keywords, line_comment, comment_after_blank, block_comment
+// ({open, close}), strings (quote bytes), multiline_strings (delimiters or
+// {open, close} pairs), word_chars,
+// punctuation, variables, tags, properties.
+static bool grammar_from_lua(lua_State* L, int t, Grammar& g, string& err){
+    if(t < 0) t = lua_gettop(L) + t + 1;
+    auto str = [&](const char* key, string& out){
+        lua_getfield(L, t, key);
+        int ty = lua_type(L, -1);
+        if(ty == LUA_TSTRING){ size_t n = 0; const char* v = lua_tolstring(L, -1, &n); out.assign(v, n); }
+        lua_pop(L, 1);
+        if(ty != LUA_TSTRING && ty != LUA_TNIL){ err = string(key) + " must be a string"; return false; }
+        return true;
+    };
+    auto list = [&](const char* key, vector<string>& out){
+        lua_getfield(L, t, key);
+        bool ok = true;
+        if(lua_type(L, -1) == LUA_TSTRING) out.push_back(lua_tostring(L, -1));
+        else if(lua_istable(L, -1)){
+            size_t n = (size_t)lua_rawlen(L, -1);
+            for(size_t i=1; i<=n && ok; ++i){
+                lua_rawgeti(L, -1, (lua_Integer)i);
+                if(lua_type(L, -1) == LUA_TSTRING){ size_t len = 0; const char* v = lua_tolstring(L, -1, &len); out.emplace_back(v, len); }
+                else ok = false;
+                lua_pop(L, 1);
+            }
+        } else if(!lua_isnil(L, -1)) ok = false;
+        lua_pop(L, 1);
+        if(!ok) err = string(key) + " must be a list of strings";
+        return ok;
+    };
+    // Each entry is a delimiter that opens and closes, or {open, close}.
+    auto ml_list = [&](const char* key, vector<MlString>& out){
+        lua_getfield(L, t, key);
+        bool ok = lua_istable(L, -1) || lua_isnil(L, -1);
+        size_t n = lua_istable(L, -1) ? (size_t)lua_rawlen(L, -1) : 0;
+        for(size_t i=1; i<=n && ok; ++i){
+            lua_rawgeti(L, -1, (lua_Integer)i);
+            if(lua_type(L, -1) == LUA_TSTRING){ string d = lua_tostring(L, -1); out.push_back(MlString{d, d}); }
+            else if(lua_istable(L, -1) && lua_rawlen(L, -1) == 2){
+                MlString m;
+                for(int k=1;k<=2;++k){
+                    lua_rawgeti(L, -1, k);
+                    if(lua_type(L, -1) == LUA_TSTRING) (k==1? m.open : m.close) = lua_tostring(L, -1);
+                    else ok = false;
+                    lua_pop(L, 1);
+                }
+                out.push_back(m);
+            } else ok = false;
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        if(!ok) err = string(key) + " must be a list of delimiters or {open, close} pairs";
+        return ok;
+    };
+    auto flag = [&](const char* key, bool& out){
+        lua_getfield(L, t, key);
+        if(!lua_isnil(L, -1)) out = lua_toboolean(L, -1) != 0;
+        lua_pop(L, 1);
+    };
+    vector<string> block;
+    if(!str("name", g.name) || !list("extensions", g.extensions) || !list("keywords", g.keywords) ||
+       !str("line_comment", g.line_comment) || !list("block_comment", block) || !str("strings", g.quotes) ||
+       !ml_list("multiline_strings", g.ml_strings) || !str("word_chars", g.word_extra) || !str("punctuation", g.punct)) return false;
+    if(!block.empty()){
+        if(block.size() != 2){ err = "block_comment must be {open, close}"; return false; }
+        g.block_open = block[0]; g.block_close = block[1];
+    }
+    flag("comment_after_blank", g.comment_after_blank);
+    flag("variables", g.vars);
+    flag("tags", g.tags);
+    flag("properties", g.props);
+    return true;
 }
 
-static string colorize_lang(const string& L, const Buffer& b, const ThemePalette& P, Lang lang){
-    if(!use_color() || !b.highlight) return L;
-
-    if(lang==Lang::Cpp || lang==Lang::Plain) return colorize(L, b, P);
-
-    string s=L;
-    try{
-        auto qd = std::regex(R"("([^"\\]|\\.)*")");
-        auto qs = std::regex(R"('([^'\\]|\\.)*')");
-        switch(lang){
-            case Lang::Python:
-                s = std::regex_replace(s, qd, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, qs, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(#.*$)"), P.dim+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\b(False|True|None|def|class|return|import|from|if|else|elif|for|while|try|except|finally|with|as|lambda|pass|yield|raise|global|nonlocal|assert|async|await|in|is|and|or|not)\b)"), P.ok+"$&"+C_RESET);
-                break;
-            case Lang::Shell:
-                s = std::regex_replace(s, qd, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, qs, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(#.*$)"), P.dim+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\b(if|then|else|elif|fi|for|in|do|done|case|esac|function|select|until|time|echo|exit|return)\b)"), P.ok+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\$[A-Za-z_][A-Za-z0-9_]*|\$\{[^}]+\})"), P.accent+"$&"+C_RESET);
-                break;
-            case Lang::Ruby:
-                s = std::regex_replace(s, qd, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, qs, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(#.*$)"), P.dim+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\b(def|class|module|if|else|elsif|end|do|while|until|return|yield|begin|rescue|ensure|case|when|then|super|self|nil|true|false)\b)"), P.ok+"$&"+C_RESET);
-                break;
-            case Lang::JS:
-                s = std::regex_replace(s, qd, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, qs, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(//.*$)"), P.dim+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\b(function|return|let|const|var|if|else|for|while|class|extends|import|export|new|try|catch|finally|throw|switch|case|default|break|continue|yield|await|async)\b)"), P.ok+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\b(true|false|null|undefined|NaN|Infinity)\b)"), P.ok+"$&"+C_RESET);
-                break;
-            case Lang::HTML:
-                s = std::regex_replace(s, std::regex(R"(<!--.*-->)"), P.dim+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(<[^>]+>)"), P.accent+"$&"+C_RESET);
-                break;
-            case Lang::CSS:
-                s = std::regex_replace(s, std::regex(R"(\/\*.*\*\/)"), P.dim+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\b([A-Za-z_-]+)(?=\s*:))"), P.ok+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"([{};:,])"), P.accent+"$&"+C_RESET);
-                break;
-            case Lang::JSON:
-                s = std::regex_replace(s, qd, P.accent+"$&"+C_RESET);
-                s = std::regex_replace(s, std::regex(R"(\b(true|false|null)\b)"), P.ok+"$&"+C_RESET);
-                break;
-            default: break;
-    }
-} catch(...) {}
-    return s;
+// End of the multi-line string closed by d, searching from i; npos if the
+// line ends first.
+static size_t ml_string_end(const string& L, size_t i, const string& d){
+    const char* s = L.data();
+    size_t n = L.size();
+    while(i < n){
+        if(s[i]=='\\'){ i += 2; continue; }
+        if(s[i]==d[0] && L.compare(i, d.size(), d) == 0) return i + d.size();
+        i++;
+    }
+    return string::npos;
+}
+
+// Lexes L starting in state st and returns the state the line ends in.
+static HlState lex_line(const LangSpec& sp, const string& L, vector<HlSpan>& out, HlState st = 0){
+    out.clear();
+    const char* s = L.data();
+    size_t n = L.size(), i = 0;
+    auto at = [&](const char* tok){
+        size_t m = std::strlen(tok);
+        return i + m <= n && std::memcmp(s + i, tok, m) == 0;
+    };
+    auto emit = [&](size_t a, size_t b, HlKind k){ if(b > a) out.push_back(HlSpan{(uint32_t)a, (uint32_t)(b - a), k}); };
+    if(st == 1 && sp.block_open){
+        size_t e = L.find(sp.block_close);
+        if(e == string::npos){ emit(0, n, HlKind::Comment); return st; }
+        i = e + std::strlen(sp.block_close);
+        emit(0, i, HlKind::Comment);
+    } else if(st >= 2 && (size_t)(st - 2) < sp.ml_strings.size()){
+        size_t e = ml_string_end(L, 0, sp.ml_strings[st - 2].close);
+        if(e == string::npos){ emit(0, n, HlKind::String); return st; }
+        i = e;
+        emit(0, i, HlKind::String);
+    }
+    while(i < n){
+        unsigned char c = (unsigned char)s[i];
+        uint8_t k = sp.cls[c];
+        if(!k){ i++; continue; }
+        if(k & HL_START){
+            if(sp.block_open && at(sp.block_open)){
+                size_t e = L.find(sp.block_close, i + std::strlen(sp.block_open));
+                if(e == string::npos){ emit(i, n, HlKind::Comment); return 1; }
+                e += std::strlen(sp.block_close);
+                emit(i, e, HlKind::Comment); i = e; continue;
+            }
+            bool ml = false;
+            for(size_t q=0; q<sp.ml_strings.size() && !ml; ++q){
+                const MlString& d = sp.ml_strings[q];
+                if(!at(d.open.c_str())) continue;
+                size_t e = ml_string_end(L, i + d.open.size(), d.close);
+                if(e == string::npos){ emit(i, n, HlKind::String); return (HlState)(2 + q); }
+                emit(i, e, HlKind::String); i = e; ml = true;
+            }
+            if(ml) continue;
+            if(sp.line_comment && at(sp.line_comment) && (!sp.comment_after_blank || i==0 || s[i-1]==' ' || s[i-1]=='\t')){
+                emit(i, n, HlKind::Comment); break;
+            }
+            if(sp.vars && c=='$' && i + 1 < n){
+                unsigned char d = (unsigned char)s[i+1];
+                if(d=='{'){
+                    size_t e = L.find('}', i + 2);
+                    if(e != string::npos && e > i + 2){ emit(i, e + 1, HlKind::Var); i = e + 1; continue; }
+                } else if(std::isalpha(d) || d=='_'){
+                    size_t e = i + 2;
+                    while(e < n && (std::isalnum((unsigned char)s[e]) || s[e]=='_')) e++;
+                    emit(i, e, HlKind::Var); i = e; continue;
+                }
+            }
+            if(sp.tags && c=='<'){
+                size_t e = L.find('>', i + 1);
+                if(e != string::npos && e > i + 1){ emit(i, e + 1, HlKind::Tag); i = e + 1; continue; }
+            }
+        }
+        if(k & HL_QUOTE){
+            size_t j = i + 1;
+            while(j < n && (unsigned char)s[j] != c) j += s[j]=='\\' ? 2 : 1;
+            if(j < n){ emit(i, j + 1, HlKind::String); i = j + 1; continue; }
+            i++; continue;              // unterminated: plain text
+        }
+        if(k & HL_WORD){
+            size_t e = i + 1;
+            while(e < n && (sp.cls[(unsigned char)s[e]] & HL_WORD)) e++;
+            if(sp.props){
+                size_t j = e;
+                while(j < n && std::isspace((unsigned char)s[j])) j++;
+                if(j < n && s[j]==':'){ emit(i, e, HlKind::Prop); i = e; continue; }
+            }
+            if(sp.keywords && sp.keywords->has(s + i, e - i)) emit(i, e, HlKind::Keyword);
+            i = e; continue;
+        }
+        if(k & HL_PUNCT){ emit(i, i + 1, HlKind::Punct); i++; continue; }
+        i++;
+    }
+    return 0;
+}
+
+static const string& hl_color(HlKind k, const ThemePalette& P){
+    switch(k){
+        case HlKind::Comment: return P.dim;
+        case HlKind::Keyword:
+        case HlKind::Prop:    return P.ok;
+        default:              return P.accent;
+    }
+}
+
+static void render_spans(const string& L, const vector<HlSpan>& spans, const ThemePalette& P, string& out){
+    size_t extra = 0;
+    for(auto& sp: spans) extra += hl_color(sp.kind, P).size() + C_RESET.size();
+    out.clear();
+    out.reserve(L.size() + extra);
+    size_t at = 0;
+    for(auto& sp: spans){
+        out.append(L, at, sp.start - at);
+        out += hl_color(sp.kind, P);
+        out.append(L, sp.start, sp.len);
+        out += C_RESET;
+        at = sp.start + sp.len;
+    }
+    out.append(L, at, string::npos);
+}
+
+// Lexed spans of recently printed lines, keyed by a hash of the line's
+// bytes, its language and the state it starts in, so paging over the same region or stepping with
+// n/N lexes each line once. An edited line hashes to a new key and the
+// rest of the cache is untouched. Entries hold spans rather than escape
+// codes, so a theme change needs no flush; rendering always reads the
+// current text, so a hash collision can only miscolour a line. Bounded by
+// entry count and bytes, least recently used first out. Main thread only.
+struct HlCache{
+    struct Entry{ uint64_t key; uint32_t len; HlState end; vector<HlSpan> spans; };
+    typedef std::list<Entry> List;
+
+    size_t capacity = 8192;
+    size_t max_bytes = 4u << 20;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+
+    static uint64_t key_for(const string& L, Lang lang, HlState st){
+        return (uint64_t)std::hash<string>()(L) ^ ((uint64_t)lang << 8 | st) * 0x9E3779B97F4A7C15ull;
+    }
+
+    const Entry* find(uint64_t key, size_t len){
+        auto it = index.find(key);
+        if(it == index.end() || it->second->len != (uint32_t)len){ misses++; return nullptr; }
+        hits++;
+        lru.splice(lru.begin(), lru, it->second);
+        return &*it->second;
+    }
+
+    void put(uint64_t key, size_t len, HlState end, const vector<HlSpan>& spans){
+        auto it = index.find(key);
+        if(it != index.end()){ bytes -= entry_bytes(*it->second); lru.erase(it->second); }
+        lru.push_front(Entry{key, (uint32_t)len, end, spans});
+        index[key] = lru.begin();
+        bytes += entry_bytes(lru.front());
+        while(lru.size() > 1 && (lru.size() > capacity || bytes > max_bytes)){
+            bytes -= entry_bytes(lru.back());
+            index.erase(lru.back().key);
+            lru.pop_back();
+            evictions++;
+        }
+    }
+
+    size_t size() const { return lru.size(); }
+    size_t memory() const { return bytes; }
+
+    void clear(){
+        lru.clear(); index.clear();
+        bytes = 0;
+        hits = misses = evictions = 0;
+    }
+
+private:
+    static size_t entry_bytes(const Entry& e){
+        // list links, hash node and bucket, plus the spans
+        return sizeof(Entry) + 6*sizeof(void*) + sizeof(uint64_t) + e.spans.capacity()*sizeof(HlSpan);
+    }
+    List lru;
+    std::unordered_map<uint64_t, List::iterator> index;
+    size_t bytes = 0;
+};
+
+static HlCache& hl_cache(){ static HlCache c; return c; }
+
+// Colours L, which starts in state st; st becomes the state it ends in.
+static string colorize_lang(const string& L, const ThemePalette& P, Lang lang, HlState& st){
+    HlCache& cache = hl_cache();
+    uint64_t key = HlCache::key_for(L, lang, st);
+    const HlCache::Entry* hit = cache.find(key, L.size());
+    static vector<HlSpan> fresh;
+    const vector<HlSpan>* spans = &fresh;
+    if(hit){ spans = &hit->spans; st = hit->end; }
+    else {
+        st = lex_line(lang_spec(lang), L, fresh, st);
+        cache.put(key, L.size(), st, fresh);
+    }
+    string out;
+    render_spans(L, *spans, P, out);
+    return out;
+}
+
+// Lexer states at the start of every HL_MARK_LINES-th line of one buffer,
+// so highlighting line i lexes at most HL_MARK_LINES lines to learn where
+// it starts, and only the first visit past the last checkpoint goes
+// further. An edit drops the checkpoints after it; the state after the
+// last line printed is kept too, so printing a range lexes each line once.
+static const size_t HL_MARK_LINES = 256;
+
+struct HlMarks{
+    uint64_t buf_id = 0;
+    Lang lang = Lang::Plain;
+    vector<HlState> marks;      // marks[c]: state at the start of 0-based line c*HL_MARK_LINES
+    size_t next_line = 0;       // 0-based line that starts in next_state
+    HlState next_state = 0;
+    bool have_next = false;
+
+    void reset(){ marks.clear(); have_next = false; }
+
+    // Line lo (1-based) changed: states of later lines may be stale.
+    void invalidate_from(size_t lo){
+        size_t keep = lo ? (lo - 1) / HL_MARK_LINES + 1 : 0;
+        if(marks.size() > keep) marks.resize(keep);
+        if(have_next && next_line >= lo) have_next = false;
+    }
+
+    // 0-based line ln starts in st: keep it if it is the next checkpoint.
+    void record(size_t ln, HlState st){
+        if(ln % HL_MARK_LINES == 0 && ln / HL_MARK_LINES == marks.size()) marks.push_back(st);
+    }
+
+    // State at the start of 0-based line i.
+    HlState state_at(const Buffer& b, Lang lg, size_t i){
+        if(b.id != buf_id || lg != lang){ reset(); buf_id = b.id; lang = lg; }
+        const LangSpec& sp = lang_spec(lg);
+        if(!sp.stateful()) return 0;
+        if(marks.empty()) marks.push_back(0);
+        // Resuming after the last line printed only helps when it does not
+        // skip a checkpoint that is still missing.
+        bool resume = have_next && next_line <= i && next_line <= marks.size() * HL_MARK_LINES;
+        if(resume && next_line == i) return next_state;
+        size_t ln = std::min(i / HL_MARK_LINES, marks.size() - 1) * HL_MARK_LINES;
+        HlState st = marks[ln / HL_MARK_LINES];
+        if(resume && next_line > ln){ ln = next_line; st = next_state; }
+        static vector<HlSpan> scratch;
+        for(; ln < i && ln < b.lines.size(); ++ln){
+            record(ln, st);
+            st = lex_line(sp, b.lines[ln], scratch, st);
+        }
+        record(ln, st);
+        return st;
+    }
+
+    // Line i (0-based) was just highlighted and ended in st.
+    void note(size_t i, HlState st){
+        next_line = i + 1; next_state = st; have_next = true;
+        record(next_line, st);
+    }
+};
+
+// Golden output: every line rendered through colorize_lang() with a palette
+// whose colours are readable markers ([accent], [ok], [dim], ...) and each
+// reset written as [/], lines in order so lexer state carries over.
+static const ThemePalette& golden_palette(){
+    static const ThemePalette P{"[accent]", "[ok]", "[warn]", "[err]", "[dim]",
+                                "[prompt]", "[input]", "[gutter]", "[title]",
+                                "[help_cmd]", "[help_arg]", "[help_text]"};
+    return P;
+}
+
+static string highlight_golden(const vector<string>& lines, Lang lang){
+    string out;
+    HlState st = 0;
+    for(auto& L: lines){
+        string line = colorize_lang(L, golden_palette(), lang, st);
+        for(size_t at = 0; (at = line.find(C_RESET, at)) != string::npos; )
+            line.replace(at, C_RESET.size(), "[/]");
+        out += line;
+        out += "\n";
+    }
+    return out;
+}
+
+// Checks every fixture in dir against its .golden file (or rewrites the
+// goldens with update). Returns the number of mismatches.
+static int verify_highlight(const string& dir, bool update){
+    std::error_code ec;
+    vector<fs::path> inputs;
+    for(auto& e: fs::directory_iterator(dir, ec))
+        if(e.is_regular_file() && e.path().extension() != ".golden") inputs.push_back(e.path());
+    if(ec || inputs.empty()){ cout<<"highlight: no fixtures in "<<dir<<"\n"; return 1; }
+    std::sort(inputs.begin(), inputs.end());
+    int failed = 0;
+    for(auto& p: inputs){
+        Buffer b;
+        load_file(p.string(), b);
+        string got = highlight_golden(b.lines, detect_lang(p.string()));
+        string gpath = p.string() + ".golden";
+        if(update){
+            std::ofstream(gpath, std::ios::binary)<<got;
+            cout<<"wrote "<<gpath<<"\n";
+            continue;
+        }
+        std::ifstream in(gpath, std::ios::binary);
+        std::ostringstream want; want<<in.rdbuf();
+        if(in && want.str() == got){ cout<<"ok   "<<p.filename().string()<<"\n"; continue; }
+        failed++;
+        cout<<"FAIL "<<p.filename().string()<<"\n";
+        std::istringstream ws(want.str()), gs(got);
+        string wl, gl;
+        for(size_t n=1; ; ++n){
+            bool hw = (bool)std::getline(ws, wl), hg = (bool)std::getline(gs, gl);
+            if(!hw && !hg) break;
+            if(hw && hg && wl == gl) continue;
+            cout<<"  line "<<n<<"\n    want: "<<(hw? wl : "(none)")<<"\n    got:  "<<(hg? gl : "(none)")<<"\n";
+        }
+    }
+    if(!update) cout<<(inputs.size() - (size_t)failed)<<"/"<<inputs.size()<<" highlight fixtures match\n";
+    return failed;
 }
@@ -3,6 +3,10 @@ struct LineReader{
     vector<string> commands;
     string color_input = "";
     string color_reset = C_RESET;
+    // Incremental search: called for every key typed at the '/' prompt to
+    // fill the rows shown under it. Returns false, leaving the rows alone,
+    // if it gave up because stop() reported another key waiting.
+    std::function<bool(const string&, const std::function<bool()>&, vector<string>&)> live_search;
 
     void set_theme_colors(const ThemePalette& P){
         color_input = P.input;
@@ -112,6 +116,7 @@ struct LineReader{
         if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO,&orig)!=-1){
             struct termios t=orig;
             t.c_lflag &= ~(ECHO|ICANON);
+            t.c_iflag &= ~IXON;
             t.c_cc[VMIN]=1; t.c_cc[VTIME]=0;
             if(tcsetattr(STDIN_FILENO,TCSAFLUSH,&t)==0) {
                 have_orig = true;
@@ -136,10 +141,73 @@ struct LineReader{
             cout.flush();
         };
 
+        auto key_waiting=[](int ms){
+            struct pollfd pfd{STDIN_FILENO, POLLIN, 0};
+            return ::poll(&pfd, 1, ms) > 0;
+        };
+
+        // '/' on an empty line or Ctrl-S: re-run the search on every key
+        // and draw the count and first hits below the prompt. Enter leaves
+        // "/query" in buf and sets accepted; Esc, Ctrl-G or backspace past the start go back
+        // to the line as it was. Returns false on EOF.
+        bool accepted = false;
+        auto incremental=[&]()->bool{
+            string q, saved = buf;
+            auto leave=[&]{
+                cout<<"\r\033[J";
+                buf = saved; cursor = buf.size(); refresh();
+            };
+            vector<string> rows;
+            bool stale = false;
+            auto draw=[&](){
+                cout<<"\r\033[J\033[?7l";
+                for(auto& r: rows) cout<<"\r\n"<<r<<color_reset;
+                cout<<"\033[?7h";
+                if(!rows.empty()) cout<<"\033["<<rows.size()<<"A";
+                cout<<"\r"<<prompt<<"/"<<color_input<<q<<color_reset;
+                cout.flush();
+            };
+            draw();
+            while(true){
+                if(stale && !key_waiting(0)){
+                    if(live_search(q, [&]{ return key_waiting(0); }, rows)){ stale = false; draw(); }
+                }
+                char c=0;
+                if(::read(STDIN_FILENO,&c,1)<=0) return false;
+                if(c=='\r'||c=='\n'){
+                    cout<<"\r\033[J"<<prompt<<"/"<<color_input<<q<<color_reset<<"\r\n";
+                    buf = "/" + q;
+                    accepted = true;
+                    return true;
+                }
+                if(c==27 && key_waiting(30)){
+                    char seq[8];
+                    ssize_t got = ::read(STDIN_FILENO, seq, sizeof seq);
+                    (void)got;
+                    continue;
+                }
+                if(c==27 || c==7){ leave(); return true; }
+                if((unsigned char)c==127 || c=='\b'){
+                    if(q.empty()){ leave(); return true; }
+                    while(!q.empty() && ((unsigned char)q.back() & 0xC0)==0x80) q.pop_back();
+                    if(!q.empty()) q.pop_back();
+                }
+                else if((unsigned char)c < 32) continue;
+                else q.push_back(c);
+                stale = true;
+                draw();
+            }
+        };
+
         refresh();
         while(true){
             char c=0; ssize_t n=::read(STDIN_FILENO,&c,1);
             if(n<=0) return string();
+            if(live_search && (c==19 || (c=='/' && buf.empty()))){
+                if(!incremental()) return string();
+                if(accepted) return buf;
+                continue;
+            }
             if(c=='\r'||c=='\n'){ cout<<"\r\n"; break; }
             else if((unsigned char)c==127||c=='\b'){
                 if(cursor>0){ buf.erase(buf.begin()+cursor-1); cursor--; refresh(); }
@@ -0,0 +1,166 @@
+// Sets of 1-based line numbers as compressed bitmaps, roaring style: lines
+// are bucketed by their high 16 bits, and each bucket is a sorted array of
+// low halves while it holds at most LS_ARRAY_MAX of them, else a 64 Kbit
+// bitmap. A bucket never costs more than 8 KB, and set algebra works one
+// bucket pair at a time without expanding either side to line numbers.
+static const size_t LS_ARRAY_MAX = 4096;
+static const size_t LS_WORDS = 65536 / 64;
+
+struct LineSet{
+    struct Chunk{
+        uint32_t key = 0;
+        size_t card = 0;
+        vector<uint16_t> arr;       // sorted low halves, when bits is empty
+        vector<uint64_t> bits;      // LS_WORDS words
+
+        bool bitmap() const { return !bits.empty(); }
+        bool has(uint16_t v) const {
+            if(bitmap()) return bits[v>>6] >> (v & 63) & 1;
+            return std::binary_search(arr.begin(), arr.end(), v);
+        }
+        void to_bitmap(){
+            if(bitmap()) return;
+            bits.assign(LS_WORDS, 0);
+            for(uint16_t v: arr) bits[v>>6] |= 1ull << (v & 63);
+            vector<uint16_t>().swap(arr);
+        }
+        // Picks the smaller form for the current contents.
+        void normalize(){
+            if(bitmap()){
+                card = 0;
+                for(uint64_t w: bits) card += (size_t)__builtin_popcountll(w);
+                if(card > LS_ARRAY_MAX) return;
+                arr.clear(); arr.reserve(card);
+                for(size_t k=0;k<LS_WORDS;++k)
+                    for(uint64_t w = bits[k]; w; w &= w - 1) arr.push_back((uint16_t)(k*64 + (size_t)__builtin_ctzll(w)));
+                vector<uint64_t>().swap(bits);
+                return;
+            }
+            card = arr.size();
+            if(card > LS_ARRAY_MAX) to_bitmap();
+        }
+    };
+    vector<Chunk> chunks;           // sorted by key, none empty
+    uint64_t buf_id = 0;
+
+    size_t size() const {
+        size_t n = 0;
+        for(auto& c: chunks) n += c.card;
+        return n;
+    }
+    size_t memory() const {
+        size_t m = sizeof(*this) + chunks.capacity()*sizeof(Chunk);
+        for(auto& c: chunks) m += c.arr.capacity()*sizeof(uint16_t) + c.bits.capacity()*sizeof(uint64_t);
+        return m;
+    }
+
+    // `lines` must be sorted and free of duplicates.
+    static LineSet from_sorted(const vector<size_t>& lines){
+        LineSet s;
+        for(size_t ln: lines){
+            uint32_t key = (uint32_t)(ln >> 16);
+            if(s.chunks.empty() || s.chunks.back().key != key){
+                if(!s.chunks.empty()) s.chunks.back().normalize();
+                s.chunks.emplace_back();
+                s.chunks.back().key = key;
+            }
+            s.chunks.back().arr.push_back((uint16_t)(ln & 0xFFFF));
+        }
+        if(!s.chunks.empty()) s.chunks.back().normalize();
+        return s;
+    }
+
+    // Lines lo..hi inclusive.
+    static LineSet from_range(size_t lo, size_t hi){
+        LineSet s;
+        while(lo <= hi){
+            uint32_t key = (uint32_t)(lo >> 16);
+            size_t end = std::min(hi, ((size_t)key << 16) | 0xFFFF);
+            Chunk c; c.key = key;
+            uint16_t a = (uint16_t)(lo & 0xFFFF), b = (uint16_t)(end & 0xFFFF);
+            if(end - lo + 1 > LS_ARRAY_MAX){
+                c.bits.assign(LS_WORDS, 0);
+                for(size_t v=a; v<=b; ++v) c.bits[v>>6] |= 1ull << (v & 63);
+            } else for(size_t v=a; v<=b; ++v) c.arr.push_back((uint16_t)v);
+            c.normalize();
+            s.chunks.push_back(std::move(c));
+            lo = end + 1;
+        }
+        return s;
+    }
+
+    // Calls fn(line) in ascending order until it returns false.
+    template<class F>
+    void each(const F& fn) const {
+        for(auto& c: chunks){
+            size_t base = (size_t)c.key << 16;
+            if(!c.bitmap()){
+                for(uint16_t v: c.arr) if(!fn(base | v)) return;
+                continue;
+            }
+            for(size_t k=0;k<LS_WORDS;++k)
+                for(uint64_t w = c.bits[k]; w; w &= w - 1)
+                    if(!fn(base | (k*64 + (size_t)__builtin_ctzll(w)))) return;
+        }
+    }
+
+    // Lines 1..nlines that are in the set.
+    void to_vector(size_t nlines, vector<size_t>& out) const {
+        out.clear();
+        each([&](size_t ln){
+            if(ln > nlines) return false;
+            if(ln) out.push_back(ln);
+            return true;
+        });
+    }
+
+    // op is '|' (union), '&' (intersection) or '-' (difference).
+    static Chunk chunk_op(const Chunk& a, const Chunk& b, char op){
+        Chunk r; r.key = a.key;
+        if(!a.bitmap() && !b.bitmap()){
+            if(op=='|') std::set_union(a.arr.begin(), a.arr.end(), b.arr.begin(), b.arr.end(), std::back_inserter(r.arr));
+            else if(op=='&') std::set_intersection(a.arr.begin(), a.arr.end(), b.arr.begin(), b.arr.end(), std::back_inserter(r.arr));
+            else std::set_difference(a.arr.begin(), a.arr.end(), b.arr.begin(), b.arr.end(), std::back_inserter(r.arr));
+        } else if(op=='&' && !a.bitmap()){
+            for(uint16_t v: a.arr) if(b.has(v)) r.arr.push_back(v);
+        } else if(op=='&' && !b.bitmap()){
+            for(uint16_t v: b.arr) if(a.has(v)) r.arr.push_back(v);
+        } else if(op=='-' && !a.bitmap()){
+            for(uint16_t v: a.arr) if(!b.has(v)) r.arr.push_back(v);
+        } else {
+            r = a; r.to_bitmap();
+            if(!b.bitmap()){
+                for(uint16_t v: b.arr){
+                    uint64_t bit = 1ull << (v & 63);
+                    if(op=='|') r.bits[v>>6] |= bit; else r.bits[v>>6] &= ~bit;
+                }
+            } else for(size_t k=0;k<LS_WORDS;++k){
+                if(op=='|') r.bits[k] |= b.bits[k];
+                else if(op=='&') r.bits[k] &= b.bits[k];
+                else r.bits[k] &= ~b.bits[k];
+            }
+        }
+        r.normalize();
+        return r;
+    }
+
+    static LineSet combine(const LineSet& a, const LineSet& b, char op){
+        LineSet r;
+        r.buf_id = a.buf_id;
+        size_t i = 0, j = 0;
+        while(i < a.chunks.size() || j < b.chunks.size()){
+            bool ha = i < a.chunks.size(), hb = j < b.chunks.size();
+            if(ha && (!hb || a.chunks[i].key < b.chunks[j].key)){
+                if(op != '&') r.chunks.push_back(a.chunks[i]);
+                i++;
+            } else if(hb && (!ha || b.chunks[j].key < a.chunks[i].key)){
+                if(op == '|') r.chunks.push_back(b.chunks[j]);
+                j++;
+            } else {
+                Chunk c = chunk_op(a.chunks[i++], b.chunks[j++], op);
+                if(c.card) r.chunks.push_back(std::move(c));
+            }
+        }
+        return r;
+    }
+};
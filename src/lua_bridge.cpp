@@ -26,3 +26,19 @@ static int l_tedit_print(lua_State* L){
     }
     return 0;
 }
+
+// tedit_grammar{...}: returns true, or nil and a message.
+static int l_tedit_grammar(lua_State* L){
+    luaL_checktype(L, 1, LUA_TTABLE);
+    std::unique_ptr<Grammar> g(new Grammar);
+    string err;
+    if(!grammar_from_lua(L, 1, *g, err) || !grammars().add(std::move(g), err)){
+        if(g_editor) cout<<g_editor->P.warn<<"tedit_grammar: "<<err<<C_RESET<<"\n";
+        lua_pushnil(L);
+        lua_pushstring(L, err.c_str());
+        return 2;
+    }
+    if(g_editor) g_editor->grammars_changed();
+    lua_pushboolean(L, 1);
+    return 1;
+}
@@ -9,26 +9,52 @@ int main(int argc, char** argv){
         }
         if(arg1 == "--help" || arg1 == "-h"){
             cout<<"usage: tedit [file ...]\n"
+                <<"       tedit - [file ...]\n"
+                <<"       tedit --session <name>\n"
+                <<"       tedit --verify-highlight <dir> [--update]\n"
                 <<"       tedit --help\n"
                 <<"       tedit --version\n"
                 <<"\n"
-                <<"Open one or more files. Extra files start as buffers.\n";
+                <<"Open one or more files. Extra files start as buffers.\n"
+                <<"Use - to read piped stdin into the first buffer while commands\n"
+                <<"are read from the terminal.\n";
             return 0;
         }
+        if(arg1 == "--verify-highlight"){
+            if(argc < 3){ cerr<<"tedit: --verify-highlight requires a directory\n"; return 1; }
+            bool update = argc >= 4 && string(argv[3]) == "--update";
+            return verify_highlight(argv[2], update) ? 1 : 0;
+        }
     }
 
     Editor ed;
 
     ed.load_config();
 
-    if(argc>=2){
+    if(argc>=2 && string(argv[1])=="--session"){
+        if(argc<3){ cerr<<"tedit: --session requires a name\n"; return 1; }
+        if(!ed.session_restore(argv[2])) return 1;
+        for(int i=3;i<argc;i++) ed.add_background_buffer(argv[i]);
+    } else if(argc>=2 && string(argv[1])=="-"){
+        if(isatty(STDIN_FILENO)){
+            cerr<<"tedit: stdin is a terminal; pipe data into 'tedit -'\n";
+            return 1;
+        }
+        int data_fd = -1; string err;
+        if(!reopen_tty_for_commands(data_fd, err)){
+            cerr<<"tedit: "<<err<<"\n";
+            return 1;
+        }
+        ed.load_stdin(data_fd);
+        for(int i=2;i<argc;i++) ed.add_background_buffer(argv[i]);
+    } else if(argc>=2){
         ed.load(argv[1]);
         for(int i=2;i<argc;i++) ed.add_background_buffer(argv[i]);
     } else { ed.buf.path.clear(); }
 
     ed.banner();
     cout<<ed.P.title<<"tedit "<<TEDIT_VERSION<<C_RESET<<"\n"
-    <<ed.P.dim<<"file: "<<C_RESET<<( ed.buf.path.empty()? "(unnamed)": ed.buf.path )<<"\n"
+    <<ed.P.dim<<"file: "<<C_RESET<<( ed.buf.streaming? "(stdin)": ed.buf.path.empty()? "(unnamed)": ed.buf.path )<<"\n"
     <<ed.P.dim<<"lines: "<<C_RESET<<ed.buf.lines.size()<<"  "
     <<ed.P.dim<<"buffers: "<<C_RESET<<ed.buffer_count()<<"  "
     <<ed.P.dim<<"help: "<<C_RESET<<"help, help <command>"<<"\n";
@@ -36,7 +62,9 @@ int main(int argc, char** argv){
 
     for(;;){
         ed.status();
+        ed.indexer.resume();
         string line = ed.lr.read(ed.prompt_str());
+        ed.indexer.pause();
         if(!std::cin.good() && line.empty()){ cout<<"\n"; break; }
         if(line.empty()) continue;
         ed.lr.remember(line);
@@ -119,6 +119,10 @@ static string tedit_themes_dir(){
     return tedit_config_dir() + "/themes";
 }
 
+static string tedit_grammars_dir(){
+    return tedit_config_dir() + "/grammars";
+}
+
 static string tedit_recovery_dir(){
     string dir = tedit_config_dir() + "/recovery";
     std::error_code ec;
@@ -126,3 +130,50 @@ static string tedit_recovery_dir(){
     chmod(dir.c_str(), 0700);
     return dir;
 }
+
+static bool reopen_tty_for_commands(int& data_fd, string& err){
+#if defined(__unix__) || defined(__APPLE__)
+    data_fd = dup(STDIN_FILENO);
+    if(data_fd < 0){ err = "dup(stdin): " + string(std::strerror(errno)); return false; }
+    int tfd = ::open("/dev/tty", O_RDWR);
+    if(tfd < 0){
+        err = "cannot open /dev/tty: " + string(std::strerror(errno));
+        ::close(data_fd); data_fd = -1;
+        return false;
+    }
+    if(dup2(tfd, STDIN_FILENO) < 0){
+        err = "dup2(/dev/tty): " + string(std::strerror(errno));
+        ::close(tfd); ::close(data_fd); data_fd = -1;
+        return false;
+    }
+    ::close(tfd);
+    return true;
+#else
+    (void)data_fd;
+    err = "reading from stdin is not supported on this platform";
+    return false;
+#endif
+}
+
+static string tedit_sessions_dir(){
+    string dir = tedit_config_dir() + "/sessions";
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    chmod(dir.c_str(), 0700);
+    return dir;
+}
+
+struct FileStamp{ long long sec=0, nsec=0; unsigned long long size=0; };
+
+static bool file_stamp(const string& path, FileStamp& out){
+    struct stat st{};
+    if(path.empty() || ::stat(path.c_str(), &st)!=0) return false;
+    out.sec = (long long)st.st_mtime;
+#if defined(__APPLE__)
+    out.nsec = (long long)st.st_mtimespec.tv_nsec;
+#elif defined(__unix__)
+    out.nsec = (long long)st.st_mtim.tv_nsec;
+#endif
+    out.size = (unsigned long long)st.st_size;
+    return true;
+}
@@ -0,0 +1,902 @@
+// Regular expressions without backtracking. A pattern compiles to a small
+// Thompson NFA program. Yes/no searches run it as a lazily built DFA whose
+// states are cached per thread; match positions and groups come from a Pike
+// VM over the same program. Both run in time linear in the input. The syntax
+// is the ECMAScript subset without lookaround or backreferences; '.' and
+// classes consume whole UTF-8 sequences.
+
+struct RegexError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+enum ReOp : uint8_t { RE_CHAR, RE_CLASS, RE_SPLIT, RE_JMP, RE_SAVE, RE_ASSERT, RE_MATCH };
+enum ReAssert : int { RA_BOL, RA_EOL, RA_WORDB, RA_NWORDB };
+
+struct ReInst{
+    ReOp op;
+    uint32_t c;
+    int x, y;
+};
+
+typedef std::pair<uint32_t,uint32_t> ReRange;
+
+struct ReClass{
+    vector<ReRange> ranges;
+    uint64_t ascii[2] = {0, 0};
+
+    bool has(uint32_t cp) const {
+        if(cp < 128) return (ascii[cp>>6] >> (cp & 63)) & 1;
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), cp, [](uint32_t v, const ReRange& r){ return v < r.first; });
+        return it != ranges.begin() && cp <= (it-1)->second;
+    }
+};
+
+static const size_t RE_MAX_PROG = 20000;
+static const int RE_MAX_REPEAT = 1000;
+static const uint32_t RE_MAX_CP = 0x10FFFF;
+
+static inline bool re_class_escape(uint32_t e){
+    return e && e < 128 && std::strchr("dDwWsS", (int)e);
+}
+
+static inline bool re_word(uint32_t c){
+    return c < 128 && (std::isalnum((int)c) || c == '_');
+}
+
+struct ReCtx{ bool bol, eol, prev_word, next_word; };
+
+static inline bool re_assert_ok(int kind, const ReCtx& c){
+    switch(kind){
+        case RA_BOL:   return c.bol;
+        case RA_EOL:   return c.eol;
+        case RA_WORDB: return c.prev_word != c.next_word;
+        default:       return c.prev_word == c.next_word;
+    }
+}
+
+static inline ReCtx re_ctx_at(const char* s, size_t n, size_t i){
+    return ReCtx{ i == 0, i == n, i > 0 && re_word((unsigned char)s[i-1]), i < n && re_word((unsigned char)s[i]) };
+}
+
+// Pike VM inputs: a byte range, or LinesText below. In multiline mode ^ and
+// $ also match next to '\n'.
+struct ReBytes{
+    const unsigned char* p; size_t n;
+    size_t size() const { return n; }
+    unsigned char operator[](size_t i) const { return p[i]; }
+};
+
+// Lines [lo, hi) of a buffer seen as one text joined by '\n', without
+// building the joined copy. Access is through a cursor that walks line by
+// line, so it is cheap for the forward scans the VM does.
+struct LinesText{
+    const vector<string>& L;
+    size_t lo, hi, n = 0;
+    mutable size_t k, start = 0;
+
+    LinesText(const vector<string>& lines, size_t first, size_t last): L(lines), lo(first), hi(last), k(first) {
+        for(size_t i=lo;i<hi;++i) n += L[i].size() + 1;
+        if(n) n--;
+    }
+    size_t size() const { return n; }
+    void seek(size_t i) const {
+        while(i < start){ k--; start -= L[k].size() + 1; }
+        while(k + 1 < hi && i >= start + L[k].size() + 1){ start += L[k].size() + 1; k++; }
+    }
+    unsigned char operator[](size_t i) const {
+        seek(i);
+        size_t off = i - start;
+        return off < L[k].size() ? (unsigned char)L[k][off] : '\n';
+    }
+    // Index into the buffer of the line holding offset i.
+    size_t line_of(size_t i) const { seek(i); return k; }
+};
+
+template<class In>
+static inline ReCtx re_ctx_in(const In& in, size_t n, size_t i, bool ml){
+    bool pnl = i > 0 && in[i-1] == '\n', nnl = i < n && in[i] == '\n';
+    return ReCtx{ i == 0 || (ml && pnl), i == n || (ml && nnl), i > 0 && re_word(in[i-1]), i < n && re_word(in[i]) };
+}
+
+static inline uint32_t re_next_cp(const ReBytes& in, size_t n, size_t& j){ return next_utf8(in.p, n, j); }
+
+template<class In>
+static inline uint32_t re_next_cp(const In& in, size_t n, size_t& j){
+    unsigned char c = in[j];
+    if(c < 0x80){ j++; return c; }
+    unsigned char b[4]; size_t m = std::min<size_t>(4, n - j), k = 0;
+    for(size_t t=0;t<m;++t) b[t] = in[j+t];
+    uint32_t cp = next_utf8(b, m, k);
+    j += k;
+    return cp;
+}
+
+static void re_normalize(vector<ReRange>& r){
+    std::sort(r.begin(), r.end());
+    vector<ReRange> out;
+    for(auto& x: r){
+        if(!out.empty() && x.first <= out.back().second + 1) out.back().second = std::max(out.back().second, x.second);
+        else out.push_back(x);
+    }
+    r.swap(out);
+}
+
+static void re_negate(vector<ReRange>& r){
+    re_normalize(r);
+    vector<ReRange> out;
+    uint32_t lo = 0;
+    for(auto& x: r){
+        if(x.first > lo) out.push_back({lo, x.first - 1});
+        lo = x.second + 1;
+    }
+    if(lo <= RE_MAX_CP) out.push_back({lo, RE_MAX_CP});
+    r.swap(out);
+}
+
+static void re_add_escape_class(vector<ReRange>& r, uint32_t k){
+    vector<ReRange> set;
+    uint32_t base = (uint32_t)std::tolower((int)k);
+    if(base == 'd') set = {{'0','9'}};
+    else if(base == 'w') set = {{'0','9'}, {'A','Z'}, {'_','_'}, {'a','z'}};
+    else set = {{'\t','\r'}, {' ',' '}, {0xA0,0xA0}, {0x1680,0x1680}, {0x2000,0x200A},
+                {0x2028,0x2029}, {0x202F,0x202F}, {0x205F,0x205F}, {0x3000,0x3000}, {0xFEFF,0xFEFF}};
+    if(k != base) re_negate(set);
+    r.insert(r.end(), set.begin(), set.end());
+}
+
+struct ReNode{
+    enum Kind { Empty, Char, Class, Cat, Alt, Repeat, Group, Assert } kind = Empty;
+    uint32_t c = 0;
+    int cls = -1, min = 0, max = 0, cap = -1, assert_kind = 0;
+    bool greedy = true;
+    vector<ReNode> kids;
+};
+
+struct ReParser{
+    vector<uint32_t> p;
+    size_t i = 0;
+    bool icase = false;
+    int ngroups = 0;
+    vector<ReClass>& classes;
+
+    ReParser(const string& pat, bool ic, vector<ReClass>& cls): icase(ic), classes(cls) {
+        const unsigned char* s = (const unsigned char*)pat.data();
+        size_t k = 0;
+        while(k < pat.size()) p.push_back(next_utf8(s, pat.size(), k));
+    }
+
+    bool more() const { return i < p.size(); }
+    bool at(uint32_t c) const { return i < p.size() && p[i] == c; }
+    [[noreturn]] void fail(const string& m) const { throw RegexError(m); }
+
+    int make_class(vector<ReRange> r, bool neg){
+        if(icase){
+            size_t n = r.size();
+            for(size_t k=0;k<n;++k){
+                uint32_t a = std::max<uint32_t>(r[k].first, 'A'), b = std::min<uint32_t>(r[k].second, 'Z');
+                if(a <= b) r.push_back({a+32, b+32});
+                a = std::max<uint32_t>(r[k].first, 'a'); b = std::min<uint32_t>(r[k].second, 'z');
+                if(a <= b) r.push_back({a-32, b-32});
+            }
+        }
+        if(neg) re_negate(r); else re_normalize(r);
+        ReClass c;
+        for(auto& x: r){
+            for(uint32_t v = x.first; v <= x.second && v < 128; ++v) c.ascii[v>>6] |= 1ull << (v & 63);
+            if(x.second >= 128) c.ranges.push_back({std::max<uint32_t>(x.first, 128), x.second});
+        }
+        classes.push_back(std::move(c));
+        return (int)classes.size() - 1;
+    }
+
+    ReNode literal(uint32_t c){
+        ReNode n;
+        if(icase && c < 128 && std::isalpha((int)c)){
+            n.kind = ReNode::Class;
+            n.cls = make_class({{c, c}}, false);
+        }else{
+            n.kind = ReNode::Char;
+            n.c = c;
+        }
+        return n;
+    }
+
+    ReNode class_node(vector<ReRange> r, bool neg){
+        ReNode n; n.kind = ReNode::Class; n.cls = make_class(std::move(r), neg);
+        return n;
+    }
+
+    uint32_t hex_digits(int count){
+        uint32_t v = 0;
+        for(int k=0;k<count;++k){
+            if(!more() || p[i] >= 128 || !std::isxdigit((int)p[i])) fail("bad hex escape");
+            uint32_t d = p[i++];
+            v = v*16 + (uint32_t)(std::isdigit((int)d) ? d-'0' : std::tolower((int)d)-'a'+10);
+        }
+        return v;
+    }
+
+    // Escapes that stand for a single character, shared by atoms and classes.
+    uint32_t char_escape(uint32_t e){
+        switch(e){
+            case 'n': return '\n';
+            case 't': return '\t';
+            case 'r': return '\r';
+            case 'f': return '\f';
+            case 'v': return '\v';
+            case '0': return 0;
+            case 'x': return hex_digits(2);
+            case 'u': return hex_digits(4);
+            case 'c':
+                if(more() && p[i] < 128 && std::isalpha((int)p[i])) return p[i++] % 32;
+                return '\\';
+            default:  return e;
+        }
+    }
+
+    ReNode parse_alt(){
+        ReNode first = parse_cat();
+        if(!at('|')) return first;
+        ReNode alt; alt.kind = ReNode::Alt;
+        alt.kids.push_back(std::move(first));
+        while(at('|')){ i++; alt.kids.push_back(parse_cat()); }
+        return alt;
+    }
+
+    ReNode parse_cat(){
+        ReNode cat; cat.kind = ReNode::Cat;
+        while(more() && !at('|') && !at(')')) cat.kids.push_back(parse_repeat());
+        if(cat.kids.size() == 1) return std::move(cat.kids[0]);
+        return cat;
+    }
+
+    bool parse_braces(int& mn, int& mx){
+        size_t save = i;
+        auto number = [&](int& out)->bool{
+            size_t start = i; long v = 0;
+            while(more() && p[i] >= '0' && p[i] <= '9'){ v = std::min<long>(v*10 + (long)(p[i]-'0'), 1000000); i++; }
+            out = (int)v;
+            return i > start;
+        };
+        i++;
+        if(!number(mn)){ i = save; return false; }
+        mx = mn;
+        if(at(',')){
+            i++;
+            if(at('}')) mx = -1;
+            else if(!number(mx)){ i = save; return false; }
+        }
+        if(!at('}')){ i = save; return false; }
+        i++;
+        if(mn > RE_MAX_REPEAT || mx > RE_MAX_REPEAT) fail("repetition count too large");
+        if(mx >= 0 && mx < mn) fail("numbers out of order in {} quantifier");
+        return true;
+    }
+
+    ReNode parse_repeat(){
+        ReNode atom = parse_atom();
+        bool quantified = false;
+        while(more()){
+            int mn = 0, mx = 0;
+            uint32_t c = p[i];
+            if(c == '*'){ mn = 0; mx = -1; i++; }
+            else if(c == '+'){ mn = 1; mx = -1; i++; }
+            else if(c == '?'){ mn = 0; mx = 1; i++; }
+            else if(c == '{'){ if(!parse_braces(mn, mx)) break; }
+            else break;
+            if(quantified || atom.kind == ReNode::Assert) fail("nothing to repeat");
+            quantified = true;
+            ReNode r; r.kind = ReNode::Repeat; r.min = mn; r.max = mx;
+            if(at('?')){ r.greedy = false; i++; }
+            r.kids.push_back(std::move(atom));
+            atom = std::move(r);
+        }
+        return atom;
+    }
+
+    ReNode parse_class(){
+        bool neg = false;
+        if(at('^')){ neg = true; i++; }
+        vector<ReRange> r;
+        while(true){
+            if(!more()) fail("unterminated character class");
+            if(at(']')){ i++; break; }
+            uint32_t lo = p[i++];
+            if(lo == '\\'){
+                if(!more()) fail("trailing backslash");
+                uint32_t e = p[i++];
+                if(re_class_escape(e)){ re_add_escape_class(r, e); continue; }
+                lo = (e == 'b') ? '\b' : char_escape(e);
+            }
+            if(at('-') && i+1 < p.size() && p[i+1] != ']'){
+                i++;
+                uint32_t hi = p[i++];
+                if(hi == '\\'){
+                    if(!more()) fail("trailing backslash");
+                    uint32_t e = p[i++];
+                    if(re_class_escape(e)) fail("invalid range in character class");
+                    hi = (e == 'b') ? '\b' : char_escape(e);
+                }
+                if(hi < lo) fail("invalid range in character class");
+                r.push_back({lo, hi});
+            }else r.push_back({lo, lo});
+        }
+        return class_node(std::move(r), neg);
+    }
+
+    ReNode parse_atom(){
+        uint32_t c = p[i++];
+        switch(c){
+            case '(': {
+                ReNode g; g.kind = ReNode::Group;
+                if(at('?')){
+                    if(i+1 < p.size() && p[i+1] == ':') i += 2;
+                    else fail("lookaround and named groups are not supported");
+                }else g.cap = ++ngroups;
+                g.kids.push_back(parse_alt());
+                if(!at(')')) fail("missing )");
+                i++;
+                return g;
+            }
+            case ')': fail("unmatched )");
+            case '*': case '+': case '?': fail("nothing to repeat");
+            case '[': return parse_class();
+            case '.': return class_node({{'\n','\n'}, {'\r','\r'}, {0x2028,0x2029}}, true);
+            case '^': case '$': {
+                ReNode a; a.kind = ReNode::Assert; a.assert_kind = (c == '^') ? RA_BOL : RA_EOL;
+                return a;
+            }
+            case '\\': {
+                if(!more()) fail("trailing backslash");
+                uint32_t e = p[i++];
+                if(re_class_escape(e)){
+                    vector<ReRange> r; re_add_escape_class(r, e);
+                    return class_node(std::move(r), false);
+                }
+                if(e == 'b' || e == 'B'){
+                    ReNode a; a.kind = ReNode::Assert; a.assert_kind = (e == 'b') ? RA_WORDB : RA_NWORDB;
+                    return a;
+                }
+                if(e >= '1' && e <= '9') fail("backreferences are not supported");
+                return literal(char_escape(e));
+            }
+            default: return literal(c);
+        }
+    }
+};
+
+struct ReCompiler{
+    vector<ReInst>& out;
+
+    int emit(ReOp op, uint32_t c = 0, int x = 0, int y = 0){
+        if(out.size() >= RE_MAX_PROG) throw RegexError("pattern too large");
+        out.push_back(ReInst{op, c, x, y});
+        return (int)out.size() - 1;
+    }
+    void patch_split(int sp, int body, int skip, bool greedy){
+        out[(size_t)sp].x = greedy ? body : skip;
+        out[(size_t)sp].y = greedy ? skip : body;
+    }
+
+    void node(const ReNode& n){
+        switch(n.kind){
+            case ReNode::Empty: break;
+            case ReNode::Char:   emit(RE_CHAR, n.c); break;
+            case ReNode::Class:  emit(RE_CLASS, 0, n.cls); break;
+            case ReNode::Assert: emit(RE_ASSERT, 0, n.assert_kind); break;
+            case ReNode::Cat:    for(auto& k: n.kids) node(k); break;
+            case ReNode::Group:
+                if(n.cap >= 0) emit(RE_SAVE, 0, 2*n.cap);
+                node(n.kids[0]);
+                if(n.cap >= 0) emit(RE_SAVE, 0, 2*n.cap+1);
+                break;
+            case ReNode::Alt: {
+                vector<int> jumps;
+                for(size_t k=0;k<n.kids.size();++k){
+                    if(k+1 == n.kids.size()){ node(n.kids[k]); break; }
+                    int sp = emit(RE_SPLIT);
+                    node(n.kids[k]);
+                    jumps.push_back(emit(RE_JMP));
+                    patch_split(sp, sp+1, (int)out.size(), true);
+                }
+                for(int j: jumps) out[(size_t)j].x = (int)out.size();
+                break;
+            }
+            case ReNode::Repeat: {
+                for(int k=0;k<n.min;++k) node(n.kids[0]);
+                if(n.max < 0){
+                    int sp = emit(RE_SPLIT);
+                    node(n.kids[0]);
+                    emit(RE_JMP, 0, sp);
+                    patch_split(sp, sp+1, (int)out.size(), n.greedy);
+                }else{
+                    vector<int> splits;
+                    for(int k=n.min;k<n.max;++k){
+                        splits.push_back(emit(RE_SPLIT));
+                        node(n.kids[0]);
+                    }
+                    for(int sp: splits) patch_split(sp, sp+1, (int)out.size(), n.greedy);
+                }
+                break;
+            }
+        }
+    }
+};
+
+struct Regex;
+static bool re_dfa_search(const Regex& rx, const char* s, size_t n, size_t from);
+
+struct Regex{
+    uint64_t id = 0;
+    string pattern;
+    bool icase = false;
+    int ngroups = 0;
+    vector<ReInst> prog;
+    vector<ReClass> classes;
+    bool first[256] = {};
+    bool any_first = false;
+
+    Regex(const string& pat, bool ic = false): pattern(pat), icase(ic) {
+        static std::atomic<uint64_t> next_id{0};
+        id = ++next_id;
+        ReParser ps(pat, ic, classes);
+        ReNode root = ps.parse_alt();
+        if(ps.more()) ps.fail("unmatched )");
+        ngroups = ps.ngroups;
+        ReCompiler cc{prog};
+        cc.emit(RE_SAVE, 0, 0);
+        cc.node(root);
+        cc.emit(RE_SAVE, 0, 1);
+        cc.emit(RE_MATCH);
+        compute_first();
+    }
+
+    // Bytes that can begin a match, so scans can skip ahead while no
+    // thread is alive. Assertions are assumed to pass; a pattern that can
+    // match empty disables the skip.
+    void compute_first(){
+        vector<char> seen(prog.size(), 0);
+        vector<int> stack{0};
+        while(!stack.empty()){
+            int pc = stack.back(); stack.pop_back();
+            if(seen[(size_t)pc]) continue;
+            seen[(size_t)pc] = 1;
+            const ReInst& in = prog[(size_t)pc];
+            switch(in.op){
+                case RE_JMP:   stack.push_back(in.x); break;
+                case RE_SPLIT: stack.push_back(in.x); stack.push_back(in.y); break;
+                case RE_SAVE: case RE_ASSERT: stack.push_back(pc+1); break;
+                case RE_MATCH: any_first = true; break;
+                case RE_CHAR: {
+                    char buf[4];
+                    put_utf8(buf, in.c);
+                    first[(unsigned char)buf[0]] = true;
+                    break;
+                }
+                case RE_CLASS: {
+                    const ReClass& c = classes[(size_t)in.x];
+                    for(int b=0;b<128;++b) if((c.ascii[b>>6] >> (b & 63)) & 1) first[b] = true;
+                    if(!c.ranges.empty()) for(int b=128;b<256;++b) first[b] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Bytes every match must start with (ASCII case folded for icase
+    // letters), read off the straight-line start of the program. Used to
+    // narrow candidate lines before running the automaton. folded is set
+    // when a two-case class like [Tt] was folded, so the prefix is only
+    // valid under ASCII case-insensitive comparison.
+    string literal_prefix(bool* folded = nullptr) const {
+        string out;
+        if(folded) *folded = false;
+        for(size_t pc=1; pc<prog.size(); ++pc){
+            const ReInst& in = prog[pc];
+            if(in.op == RE_SAVE || in.op == RE_ASSERT) continue;
+            if(in.op == RE_CHAR){
+                char buf[4];
+                out.append(buf, (size_t)(put_utf8(buf, in.c) - buf));
+                continue;
+            }
+            if(in.op != RE_CLASS) break;
+            const ReClass& c = classes[(size_t)in.x];
+            int lo = -1, n = 0;
+            for(int b=0;b<128;++b) if((c.ascii[b>>6] >> (b & 63)) & 1){ if(lo < 0) lo = b; n++; }
+            if(!c.ranges.empty() || n != 2 || !std::isupper(lo) || !c.has((uint32_t)std::tolower(lo))) break;
+            out += (char)std::tolower(lo);
+            if(folded) *folded = true;
+        }
+        return out;
+    }
+
+    size_t slots() const { return 2 * (size_t)(ngroups + 1); }
+
+    bool consumes(const ReInst& in, uint32_t cp) const {
+        return in.op == RE_CHAR ? in.c == cp : classes[(size_t)in.x].has(cp);
+    }
+
+    bool search(const char* s, size_t n, size_t from = 0) const { return re_dfa_search(*this, s, n, from); }
+    bool search(const string& s) const { return search(s.data(), s.size()); }
+
+    // Leftmost match starting at or after `from`; caps receives byte offsets
+    // for the whole match and each group (npos when a group did not take part).
+    bool find(const string& s, size_t from, vector<size_t>& caps) const;
+    // Non-empty match starting exactly at `from`, used to step past an
+    // empty match the way std::regex_replace does.
+    bool find_nonempty_at(const string& s, size_t from, vector<size_t>& caps) const;
+    // Leftmost match in joined lines at or after `from`, with ^ and $ also
+    // matching at line breaks.
+    bool find(const LinesText& t, size_t from, vector<size_t>& caps) const;
+};
+
+struct RePike{
+    struct List{
+        vector<int> sparse, dense;
+        vector<size_t> caps;
+        size_t n = 0;
+        bool has(int pc) const { size_t k = (size_t)sparse[(size_t)pc]; return k < n && dense[k] == pc; }
+        size_t add(int pc){ sparse[(size_t)pc] = (int)n; dense[n] = pc; return n++; }
+    };
+    struct Entry{ int pc, slot; size_t old; };
+    List a, b;
+    vector<size_t> tmp, blank;
+    vector<Entry> stack;
+
+    void prepare(size_t np, size_t ns){
+        for(List* l: {&a, &b}){
+            if(l->sparse.size() < np){ l->sparse.assign(np, 0); l->dense.assign(np, 0); }
+            if(l->caps.size() < np*ns) l->caps.resize(np*ns);
+            l->n = 0;
+        }
+        blank.assign(ns, string::npos);
+    }
+
+    void add(const Regex& rx, List& l, int pc0, const size_t* caps0, const ReCtx& ctx, size_t pos){
+        size_t ns = rx.slots();
+        tmp.assign(caps0, caps0 + ns);
+        stack.clear();
+        stack.push_back(Entry{pc0, -1, 0});
+        while(!stack.empty()){
+            Entry e = stack.back(); stack.pop_back();
+            if(e.slot >= 0){ tmp[(size_t)e.slot] = e.old; continue; }
+            if(l.has(e.pc)) continue;
+            size_t k = l.add(e.pc);
+            const ReInst& in = rx.prog[(size_t)e.pc];
+            switch(in.op){
+                case RE_JMP: stack.push_back(Entry{in.x, -1, 0}); break;
+                case RE_SPLIT:
+                    stack.push_back(Entry{in.y, -1, 0});
+                    stack.push_back(Entry{in.x, -1, 0});
+                    break;
+                case RE_SAVE:
+                    stack.push_back(Entry{0, in.x, tmp[(size_t)in.x]});
+                    tmp[(size_t)in.x] = pos;
+                    stack.push_back(Entry{e.pc+1, -1, 0});
+                    break;
+                case RE_ASSERT:
+                    if(re_assert_ok(in.x, ctx)) stack.push_back(Entry{e.pc+1, -1, 0});
+                    break;
+                default:
+                    std::copy(tmp.begin(), tmp.end(), l.caps.begin() + (long)(k*ns));
+                    break;
+            }
+        }
+    }
+
+    bool run(const Regex& rx, const string& str, size_t from, vector<size_t>& caps, bool anchored, bool not_null){
+        return run(rx, ReBytes{(const unsigned char*)str.data(), str.size()}, from, caps, anchored, not_null, false);
+    }
+
+    template<class In>
+    bool run(const Regex& rx, const In& in, size_t from, vector<size_t>& caps, bool anchored, bool not_null, bool ml){
+        size_t n = in.size(), ns = rx.slots();
+        prepare(rx.prog.size(), ns);
+        caps.assign(ns, string::npos);
+        List* cl = &a; List* nl = &b;
+        bool matched = false;
+        size_t i = from;
+        bool skip = !anchored && !rx.any_first;
+        while(true){
+            if(skip && cl->n == 0 && !matched) while(i < n && !rx.first[in[i]]) i++;
+            if(!matched && (!anchored || i == from)) add(rx, *cl, 0, blank.data(), re_ctx_in(in, n, i, ml), i);
+            if(cl->n == 0) break;
+            uint32_t cp = 0; size_t j = i;
+            if(i < n) cp = re_next_cp(in, n, j);
+            ReCtx nctx = re_ctx_in(in, n, j, ml);
+            nl->n = 0;
+            for(size_t k=0;k<cl->n;++k){
+                const ReInst& in = rx.prog[(size_t)cl->dense[k]];
+                if(in.op == RE_MATCH){
+                    if(not_null && i == from) continue;
+                    matched = true;
+                    std::copy(cl->caps.begin() + (long)(k*ns), cl->caps.begin() + (long)((k+1)*ns), caps.begin());
+                    break;
+                }
+                if((in.op == RE_CHAR || in.op == RE_CLASS) && i < n && rx.consumes(in, cp))
+                    add(rx, *nl, cl->dense[k]+1, &cl->caps[k*ns], nctx, j);
+            }
+            std::swap(cl, nl);
+            if(i >= n) break;
+            i = j;
+        }
+        return matched;
+    }
+};
+
+// Lazily built DFA. A state is the set of NFA program counters still alive
+// before the next character plus whether we are at the start of the input
+// and whether the previous character was a word character; assertions are
+// resolved when the next character is known. ASCII transitions live in a
+// flat table, other code points in a hash map. The cache is dropped and
+// rebuilt when it grows past RE_DFA_MAX_STATES.
+static const size_t RE_DFA_MAX_STATES = 2048;
+
+struct ReDfa{
+    struct State{
+        vector<int> kernel;
+        uint8_t flags = 0;
+        int end = -1;
+        bool idle = false;
+        int next[128];
+    };
+    uint64_t id = 0;
+    const Regex* rx = nullptr;
+    vector<State> states;
+    std::unordered_map<string,int> index;
+    std::unordered_map<uint64_t,int> wide;
+    int starts[4] = {-1, -1, -1, -1};
+    unsigned epoch = 0;
+    vector<int> mark, stack, kernel, out;
+    int gen = 0;
+
+    void bind(const Regex& r){
+        rx = &r; id = r.id;
+        mark.assign(r.prog.size(), 0); gen = 0;
+        clear();
+    }
+    void clear(){
+        states.clear(); index.clear(); wide.clear();
+        for(int& s: starts) s = -1;
+        epoch++;
+    }
+
+    int intern(const vector<int>& k, uint8_t flags){
+        string key((const char*)k.data(), k.size()*sizeof(int));
+        key.push_back((char)flags);
+        auto it = index.find(key);
+        if(it != index.end()) return it->second;
+        if(states.size() >= RE_DFA_MAX_STATES){ clear(); }
+        states.emplace_back();
+        State& st = states.back();
+        st.kernel = k; st.flags = flags;
+        st.idle = k.size() == 1 && k[0] == 0;
+        std::fill(st.next, st.next + 128, -1);
+        int id_ = (int)states.size() - 1;
+        index.emplace(std::move(key), id_);
+        return id_;
+    }
+
+    int start(uint8_t flags){
+        if(starts[flags] < 0){ vector<int> k{0}; int s = intern(k, flags); starts[flags] = s; }
+        return starts[flags];
+    }
+
+    // Follows epsilon edges from the kernel; returns whether MATCH is
+    // reachable and fills `out` with the kernel after consuming cp.
+    bool closure(const vector<int>& k, uint8_t flags, bool has_cp, uint32_t cp){
+        ReCtx ctx{ (flags & 1) != 0, !has_cp, (flags & 2) != 0, has_cp && re_word(cp) };
+        if(++gen == 0){ std::fill(mark.begin(), mark.end(), 0); gen = 1; }
+        bool matched = false;
+        out.clear();
+        stack.assign(k.rbegin(), k.rend());
+        while(!stack.empty()){
+            int pc = stack.back(); stack.pop_back();
+            if(mark[(size_t)pc] == gen) continue;
+            mark[(size_t)pc] = gen;
+            const ReInst& in = rx->prog[(size_t)pc];
+            switch(in.op){
+                case RE_JMP:    stack.push_back(in.x); break;
+                case RE_SPLIT:  stack.push_back(in.y); stack.push_back(in.x); break;
+                case RE_SAVE:   stack.push_back(pc+1); break;
+                case RE_ASSERT: if(re_assert_ok(in.x, ctx)) stack.push_back(pc+1); break;
+                case RE_MATCH:  matched = true; break;
+                default:        if(has_cp && rx->consumes(in, cp)) out.push_back(pc+1); break;
+            }
+        }
+        out.push_back(0);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+        return matched;
+    }
+
+    int step(int s, uint32_t cp){
+        kernel = states[(size_t)s].kernel;
+        bool m = closure(kernel, states[(size_t)s].flags, true, cp);
+        unsigned before = epoch;
+        int nid = intern(out, re_word(cp) ? 2 : 0);
+        int v = nid * 2 + (m ? 1 : 0);
+        if(epoch == before){
+            if(cp < 128) states[(size_t)s].next[cp] = v;
+            else wide[(uint64_t)s << 21 | cp] = v;
+        }
+        return v;
+    }
+
+    bool end_match(int s){
+        State& st = states[(size_t)s];
+        if(st.end < 0){
+            kernel = st.kernel;
+            st.end = closure(kernel, st.flags, false, 0) ? 1 : 0;
+        }
+        return st.end == 1;
+    }
+
+    bool search(const char* p, size_t n, size_t from){
+        uint8_t flags = (from == 0 ? 1 : 0) | (from > 0 && re_word((unsigned char)p[from-1]) ? 2 : 0);
+        int st = start(flags);
+        const unsigned char* u = (const unsigned char*)p;
+        size_t i = from;
+        bool skip = !rx->any_first;
+        while(i < n){
+            if(skip && states[(size_t)st].idle && !rx->first[u[i]]){
+                while(i < n && !rx->first[u[i]]) i++;
+                if(i == n) return false;
+                st = start(re_word(u[i-1]) ? 2 : 0);
+            }
+            int v;
+            if(u[i] < 128){
+                v = states[(size_t)st].next[u[i]];
+                if(v < 0) v = step(st, u[i]);
+                i++;
+            }else{
+                uint32_t cp = next_utf8(u, n, i);
+                auto it = wide.find((uint64_t)st << 21 | cp);
+                v = (it != wide.end()) ? it->second : step(st, cp);
+            }
+            if(v & 1) return true;
+            st = v >> 1;
+        }
+        return end_match(st);
+    }
+};
+
+static ReDfa& re_dfa_for(const Regex& rx){
+    static const size_t SLOTS = 8;
+    thread_local ReDfa slots[SLOTS];
+    thread_local size_t victim = 0;
+    for(auto& d: slots) if(d.id == rx.id) return d;
+    ReDfa& d = slots[victim++ % SLOTS];
+    d.bind(rx);
+    return d;
+}
+
+static bool re_dfa_search(const Regex& rx, const char* s, size_t n, size_t from){
+    return re_dfa_for(rx).search(s, n, from);
+}
+
+bool Regex::find(const string& s, size_t from, vector<size_t>& caps) const {
+    if(from > s.size() || !search(s.data(), s.size(), from)) return false;
+    thread_local RePike vm;
+    return vm.run(*this, s, from, caps, false, false);
+}
+
+bool Regex::find(const LinesText& t, size_t from, vector<size_t>& caps) const {
+    if(from > t.size()) return false;
+    thread_local RePike vm;
+    return vm.run(*this, t, from, caps, false, false, true);
+}
+bool Regex::find_nonempty_at(const string& s, size_t from, vector<size_t>& caps) const {
+    if(from >= s.size()) return false;
+    thread_local RePike vm;
+    return vm.run(*this, s, from, caps, true, true);
+}
+
+// ECMAScript replacement syntax: $& $` $' $$ and $n / $nn.
+static void re_format(string& out, const string& s, const vector<size_t>& caps, const string& fmt, int ngroups){
+    for(size_t k=0;k<fmt.size();++k){
+        char c = fmt[k];
+        if(c != '$' || k+1 >= fmt.size()){ out.push_back(c); continue; }
+        char d = fmt[k+1];
+        if(d == '$'){ out.push_back('$'); k++; }
+        else if(d == '&'){ out.append(s, caps[0], caps[1]-caps[0]); k++; }
+        else if(d == '`'){ out.append(s, 0, caps[0]); k++; }
+        else if(d == '\''){ out.append(s, caps[1], string::npos); k++; }
+        else if(d >= '0' && d <= '9'){
+            int g = d - '0'; size_t used = 1;
+            if(k+2 < fmt.size() && fmt[k+2] >= '0' && fmt[k+2] <= '9' && g*10 + (fmt[k+2]-'0') <= ngroups){
+                g = g*10 + (fmt[k+2]-'0'); used = 2;
+            }
+            if(g == 0 || g > ngroups){ out.push_back(c); continue; }
+            size_t b = caps[2*(size_t)g], e = caps[2*(size_t)g+1];
+            if(b != string::npos) out.append(s, b, e-b);
+            k += used;
+        }
+        else out.push_back(c);
+    }
+}
+
+// Appends s with matches of rx replaced by fmt (every match, or only the
+// first) to out and returns the number of replacements. Empty matches are
+// stepped over the way std::regex_replace does.
+static size_t re_substitute(const string& s, const Regex& rx, const string& fmt, bool global, string& out){
+    vector<size_t> caps, step;
+    size_t pos = 0, count = 0;
+    while(pos <= s.size() && rx.find(s, pos, caps)){
+        out.append(s, pos, caps[0]-pos);
+        re_format(out, s, caps, fmt, rx.ngroups);
+        count++;
+        if(!global){ pos = caps[1]; break; }
+        if(caps[1] > caps[0]){ pos = caps[1]; continue; }
+        if(caps[1] >= s.size()){ pos = s.size() + 1; break; }
+        if(rx.find_nonempty_at(s, caps[1], step)){
+            re_format(out, s, step, fmt, rx.ngroups);
+            count++;
+            pos = step[1];
+            continue;
+        }
+        size_t j = caps[1];
+        (void)next_utf8((const unsigned char*)s.data(), s.size(), j);
+        out.append(s, caps[1], j-caps[1]);
+        pos = j;
+    }
+    if(pos < s.size()) out.append(s, pos, string::npos);
+    return count;
+}
+
+static string re_replace(const string& s, const Regex& rx, const string& fmt){
+    string out;
+    re_substitute(s, rx, fmt, true, out);
+    return out;
+}
+
+// Process-wide LRU of compiled patterns keyed by flags and pattern text.
+// Entries are shared so a caller keeps its Regex alive across an eviction.
+struct RegexCache{
+    typedef std::shared_ptr<const Regex> Ptr;
+    typedef std::list<std::pair<string, Ptr>> List;
+
+    size_t capacity = 128;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+
+    Ptr get(const string& pat, bool icase){
+        string key(1, icase ? 'i' : '-');
+        key += pat;
+        std::lock_guard<std::mutex> lk(m);
+        auto it = index.find(key);
+        if(it != index.end()){
+            hits++;
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->second;
+        }
+        misses++;
+        Ptr rx = std::make_shared<const Regex>(pat, icase);
+        lru.emplace_front(key, rx);
+        index[key] = lru.begin();
+        while(lru.size() > capacity){
+            index.erase(lru.back().first);
+            lru.pop_back();
+            evictions++;
+        }
+        return rx;
+    }
+
+    size_t size(){ std::lock_guard<std::mutex> lk(m); return lru.size(); }
+
+    void clear(){
+        std::lock_guard<std::mutex> lk(m);
+        lru.clear(); index.clear();
+        hits = misses = evictions = 0;
+    }
+
+private:
+    std::mutex m;
+    List lru;
+    std::unordered_map<string, List::iterator> index;
+};
+
+static RegexCache& regex_cache(){ static RegexCache c; return c; }
+
+static std::shared_ptr<const Regex> compiled_regex(const string& pat, bool icase = false){
+    return regex_cache().get(pat, icase);
+}
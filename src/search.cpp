@@ -1,50 +1,268 @@
 static size_t search_plain_allhits(const Buffer& b, const string& q, bool icase, vector<size_t>& out_lines){
     out_lines.clear();
     if(q.empty()) return 0;
-    string qq = icase? lower(q): q;
-    for(size_t i=0;i<b.lines.size();++i){
-        string L = icase? lower(b.lines[i]) : b.lines[i];
-        if(L.find(qq)!=string::npos) out_lines.push_back(i+1);
-    }
+    LiteralMatcher lm(q, icase);
+    auto test = [&](const string& L){ return lm.matches(L); };
+    vector<LineSpan> spans;
+    if(b.tri && b.tri->candidates(q, spans)) parallel_span_scan(b.lines, spans, test, out_lines);
+    else parallel_line_scan(b.lines, test, out_lines);
     return out_lines.size();
 }
-static size_t search_plain(const Buffer& b, const string& q, bool icase){
-    vector<size_t> hits;
-    size_t n = search_plain_allhits(b,q,icase,hits);
-    if(!n){ cout<<"no matches\n"; return 0; }
+static void print_hits(const Buffer& b, const vector<size_t>& hits){
+    if(hits.empty()){ cout<<"no matches\n"; return; }
     for(auto ln: hits) cout<<"match at "<<ln<<": "<<b.lines[ln-1]<<"\n";
-    return n;
 }
-static size_t search_regex(const Buffer& b, const string& pat, bool icase=false){
-    size_t hits=0; try{
-        std::regex::flag_type flags = std::regex::ECMAScript;
-        if(icase) flags |= std::regex::icase;
-        std::regex rx(pat, flags);
-        for(size_t i=0;i<b.lines.size();++i){
-            if(std::regex_search(b.lines[i], rx)){
-                cout<<"match at "<<i+1<<": "<<b.lines[i]<<"\n"; hits++;
-            }
+
+typedef std::function<bool(const string&)> LineTest;
+
+// Sorted hit list for the last literal search, or for a custom line test
+// (findf) keyed by its command text. Edits report the line span they
+// replaced so only those lines are rescanned and later hits shifted; a
+// buffer id or line-count mismatch forces a full rebuild.
+struct MatchIndex{
+    uint64_t buf_id = 0;
+    string pat;
+    bool icase = false;
+    bool valid = false;
+    size_t line_count = 0;
+    vector<size_t> hits;
+    LineTest custom;
+    string narrow;              // literal every custom hit contains, or empty
+
+    bool usable(const Buffer& b, const string& q, bool ic) const {
+        return valid && buf_id==b.id && line_count==b.lines.size() && icase==ic && pat==q;
+    }
+    const vector<size_t>& get(const Buffer& b, const string& q, bool ic){
+        if(!usable(b, q, ic) || custom){
+            custom = nullptr;
+            search_plain_allhits(b, q, ic, hits);
+            buf_id = b.id; pat = q; icase = ic; line_count = b.lines.size(); valid = true;
         }
+        return hits;
+    }
+    const vector<size_t>& get_custom(const Buffer& b, const string& key, const LineTest& test, const string& need){
+        if(!usable(b, key, false) || !custom){
+            custom = test; narrow = need;
+            vector<LineSpan> spans;
+            if(!(b.tri && b.tri->candidates(need, spans))) spans.assign(1, LineSpan{0, b.lines.size()});
+            hits.clear();
+            parallel_span_scan(b.lines, spans, test, hits);
+            buf_id = b.id; pat = key; icase = false; line_count = b.lines.size(); valid = true;
+        }
+        return hits;
+    }
+    LineTest line_test() const {
+        if(custom) return custom;
+        auto lm = std::make_shared<LiteralMatcher>(pat, icase);
+        return [lm](const string& L){ return lm->matches(L); };
+    }
+    void invalidate(){ valid = false; hits.clear(); }
+
+    // Lines [lo, lo+old_n) (1-based) were replaced by new_n lines.
+    void lines_changed(const Buffer& b, size_t lo, size_t old_n, size_t new_n){
+        if(!valid || buf_id!=b.id) return;
+        if(line_count + new_n - old_n != b.lines.size()){ invalidate(); return; }
+        auto first = std::lower_bound(hits.begin(), hits.end(), lo);
+        auto last = std::lower_bound(first, hits.end(), lo + old_n);
+        size_t at = (size_t)(first - hits.begin());
+        hits.erase(first, last);
+        for(auto it = hits.begin() + (long)at; it != hits.end(); ++it) *it = *it + new_n - old_n;
+        LineTest test = line_test();
+        vector<size_t> fresh;
+        for(size_t i=lo;i<lo+new_n;++i) if(test(b.lines[i-1])) fresh.push_back(i);
+        hits.insert(hits.begin() + (long)at, fresh.begin(), fresh.end());
+        line_count = b.lines.size();
+    }
+
+    // Lines were rewritten in place; `changed` is sorted and 1-based.
+    void lines_rewritten(const Buffer& b, const vector<size_t>& changed){
+        if(!valid || buf_id!=b.id || changed.empty()) return;
+        if(line_count != b.lines.size()){ invalidate(); return; }
+        LineTest test = line_test();
+        vector<size_t> merged;
+        merged.reserve(hits.size());
+        size_t k = 0;
+        for(size_t ln: changed){
+            while(k < hits.size() && hits[k] < ln) merged.push_back(hits[k++]);
+            if(k < hits.size() && hits[k] == ln) k++;
+            if(test(b.lines[ln-1])) merged.push_back(ln);
+        }
+        merged.insert(merged.end(), hits.begin() + (long)k, hits.end());
+        hits.swap(merged);
+    }
+};
+static size_t search_regex_allhits(const Buffer& b, const Regex& rx, vector<size_t>& out_lines){
+    out_lines.clear();
+    auto test = [&](const string& L){ return rx.search(L); };
+    vector<LineSpan> spans;
+    if(b.tri && b.tri->candidates(rx.literal_prefix(), spans)) parallel_span_scan(b.lines, spans, test, out_lines);
+    else parallel_line_scan(b.lines, test, out_lines);
+    return out_lines.size();
+}
+static size_t search_regex(const Buffer& b, const string& pat, bool icase=false){
+    vector<size_t> hits; try{
+        auto rx = compiled_regex(pat, icase);
+        search_regex_allhits(b, *rx, hits);
     } catch(const std::exception& e){ cout<<"regex: "<<e.what()<<"\n"; return 0; }
-    if(!hits) cout<<"no matches\n";
-    return hits;
-}
-static int replace_first_line(const string& s,const string& needle,const string& repl,string& out){
-    auto pos=s.find(needle);
-    if(pos==string::npos){ out=s; return 0; }
-    out = s.substr(0,pos) + repl + s.substr(pos+needle.size());
-    return 1;
-}
-static int replace_all_line(const string& s,const string& needle,const string& repl,string& out){
-    if(needle.empty()){ out=s; return 0; }
-    int cnt=0; size_t pos=0; out.clear();
-    while(true){
-        auto p=s.find(needle,pos);
-        if(p==string::npos){ out += s.substr(pos); break; }
-        out += s.substr(pos, p-pos);
+    if(hits.empty()){ cout<<"no matches\n"; return 0; }
+    for(auto ln: hits) cout<<"match at "<<ln<<": "<<b.lines[ln-1]<<"\n";
+    return hits.size();
+}
+// search_plain_allhits for the incremental prompt: gives up and returns
+// false as soon as stop() reports a pending key. With `within` (the hits of
+// a query that q contains) only those lines are tested.
+static bool search_plain_cancellable(const Buffer& b, const string& q, const vector<size_t>* within,
+                                     const std::function<bool()>& stop, vector<size_t>& out){
+    out.clear();
+    LiteralMatcher lm(q, false);
+    if(within){
+        for(size_t k=0;k<within->size();++k){
+            if(k % PAR_CHUNK_LINES == 0 && stop()) return false;
+            size_t ln = (*within)[k];
+            if(lm.matches(b.lines[ln-1])) out.push_back(ln);
+        }
+        return true;
+    }
+    vector<LineSpan> spans, pieces;
+    if(!(b.tri && b.tri->candidates(q, spans))) spans.assign(1, LineSpan{0, b.lines.size()});
+    for(auto& sp: spans)
+        for(size_t lo=sp.first; lo<sp.second; lo+=PAR_CHUNK_LINES) pieces.push_back({lo, std::min(sp.second, lo + PAR_CHUNK_LINES)});
+    vector<vector<size_t>> parts(pieces.size());
+    std::atomic<bool> cancelled{false};
+    WorkerPool::get().run(pieces.size(), [&](size_t t){
+        if(cancelled.load(std::memory_order_relaxed)) return;
+        if(stop()){ cancelled = true; return; }
+        for(size_t i=pieces[t].first;i<pieces[t].second;++i) if(lm.matches(b.lines[i])) parts[t].push_back(i+1);
+    });
+    if(cancelled) return false;
+    for(auto& p: parts) out.insert(out.end(), p.begin(), p.end());
+    return true;
+}
+
+// Last completed incremental query; only valid while the prompt is open.
+static const size_t LIVE_ROWS = 5;
+struct LiveSearch{
+    uint64_t buf_id = 0;
+    size_t line_count = 0;
+    string q;
+    vector<size_t> hits;
+    bool valid = false;
+};
+
+// Hits of the last findall/findreall/grep. Buffer hits carry the buffer
+// id, which survives buffer switching; grep hits carry a file path (buf 0).
+struct HitList{
+    struct Hit{ uint64_t buf; size_t line; string path; };
+    string pat;
+    bool icase = false, regex = false;
+    vector<Hit> hits;
+    size_t cur = 0;
+};
+
+// Scans several buffers in one pool run; `key` is the literal used to
+// narrow buffers that carry a trigram index.
+template<class Test>
+static void search_buffers(const vector<const Buffer*>& bufs, const string& key, const Test& test, vector<vector<size_t>>& out){
+    vector<const vector<string>*> docs;
+    vector<vector<LineSpan>> spans(bufs.size());
+    for(size_t d=0;d<bufs.size();++d){
+        docs.push_back(&bufs[d]->lines);
+        if(!(bufs[d]->tri && bufs[d]->tri->candidates(key, spans[d]))) spans[d] = {{0, bufs[d]->lines.size()}};
+    }
+    out.clear();
+    parallel_multi_scan(docs, spans, test, out);
+}
+
+// Matches of rx across lines lo..hi (1-based) as (first, last) line pairs.
+// Empty matches are stepped over and not reported.
+static void search_multiline(const Buffer& b, size_t lo, size_t hi, const Regex& rx, vector<std::pair<size_t,size_t>>& out){
+    out.clear();
+    if(lo < 1 || hi < lo) return;
+    LinesText t(b.lines, lo-1, hi);
+    vector<size_t> caps;
+    size_t pos = 0;
+    while(pos <= t.size() && rx.find(t, pos, caps)){
+        size_t s = caps[0], e = caps[1];
+        if(e == s){ pos = s + 1; continue; }
+        out.push_back({t.line_of(s) + 1, t.line_of(e - 1) + 1});
+        pos = e;
+    }
+}
+
+// Rewrites one line given the first hit of lm in it. Counts the hits
+// first so the output is allocated once.
+static size_t replace_in_line(const LiteralMatcher& lm, const string& L, const char* hit, const string& repl, bool global, string& out){
+    size_t m = lm.pat.size(), cnt = 1;
+    const char* end = L.data() + L.size();
+    if(global) for(const char* h = hit + m; h <= end && (h = lm.find(h, (size_t)(end - h))); h += m) cnt++;
+    out.clear();
+    out.reserve(L.size() - cnt*m + cnt*repl.size());
+    const char* p = L.data();
+    for(size_t k=0; k<cnt; ++k){
+        out.append(p, hit);
         out += repl;
-        pos = p + needle.size();
-        cnt++;
+        p = hit + m;
+        if(k + 1 < cnt) hit = lm.find(p, (size_t)(end - p));
     }
+    out.append(p, end);
     return cnt;
 }
+
+struct LineEdit{ size_t idx; string text; size_t count; };
+
+// Runs fn(line, out) over the lines in spans (sorted, disjoint, 0-based);
+// fn returns how many replacements it made, 0 leaving the line alone.
+// Rewritten lines come back in order in out and the buffer itself is left
+// untouched. Large inputs are split across the worker pool.
+template<class Rewrite>
+static void rewrite_spans(const vector<string>& lines, const vector<LineSpan>& spans, const Rewrite& fn, vector<LineEdit>& out){
+    out.clear();
+    auto run = [&](size_t a, size_t b, vector<LineEdit>& dst){
+        string tmp;
+        for(size_t i=a;i<b;++i){
+            tmp.clear();
+            size_t c = fn(lines[i], tmp);
+            if(c) dst.push_back(LineEdit{i, std::move(tmp), c});
+        }
+    };
+    size_t n = 0;
+    for(auto& sp: spans) n += sp.second - sp.first;
+    WorkerPool& pool = WorkerPool::get();
+    if(n < PAR_MIN_LINES || pool.size() <= 1){
+        for(auto& sp: spans) run(sp.first, sp.second, out);
+        return;
+    }
+    size_t chunk = std::max(PAR_CHUNK_LINES, n / (pool.size() * 8) + 1);
+    vector<LineSpan> pieces;
+    for(auto& sp: spans)
+        for(size_t a=sp.first; a<sp.second; a+=chunk) pieces.push_back({a, std::min(sp.second, a + chunk)});
+    vector<vector<LineEdit>> parts(pieces.size());
+    pool.run(pieces.size(), [&](size_t t){ run(pieces[t].first, pieces[t].second, parts[t]); });
+    for(auto& p: parts) for(auto& e: p) out.push_back(std::move(e));
+}
+
+template<class Rewrite>
+static void rewrite_lines(const vector<string>& lines, size_t lo, size_t hi, const Rewrite& fn, vector<LineEdit>& out){
+    rewrite_spans(lines, vector<LineSpan>{{lo, std::max(lo, hi)}}, fn, out);
+}
+
+// Literal replacement: lines without a hit are only scanned.
+static void replace_lines(const vector<string>& lines, size_t lo, size_t hi, const string& old, const string& repl, bool global, vector<LineEdit>& out){
+    out.clear();
+    if(old.empty()) return;
+    LiteralMatcher lm(old, false);
+    rewrite_lines(lines, lo, hi, [&](const string& L, string& dst)->size_t{
+        const char* h = lm.find(L.data(), L.size());
+        return h? replace_in_line(lm, L, h, repl, global, dst) : 0;
+    }, out);
+}
+
+// Regex replacement; the DFA rejects non-matching lines before any copy.
+static void substitute_spans(const vector<string>& lines, const vector<LineSpan>& spans, const Regex& rx, const string& fmt, bool global, vector<LineEdit>& out){
+    rewrite_spans(lines, spans, [&](const string& L, string& dst)->size_t{
+        return rx.search(L)? re_substitute(L, rx, fmt, global, dst) : 0;
+    }, out);
+}
+static void substitute_lines(const vector<string>& lines, size_t lo, size_t hi, const Regex& rx, const string& fmt, bool global, vector<LineEdit>& out){
+    substitute_spans(lines, vector<LineSpan>{{lo, std::max(lo, hi)}}, rx, fmt, global, out);
+}
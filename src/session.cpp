@@ -0,0 +1,109 @@
+static const char SESSION_MAGIC[8] = {'T','E','D','S','E','S','S','1'};
+static const uint64_t SESSION_VERSION = 2;
+enum : uint64_t { SESS_META=1, SESS_ALIASES=2, SESS_BUFFERS=3, SESS_UNDO=4, SESS_REDO=5, SESS_END=99 };
+
+// All fields are little-endian u64 and every record is padded to 8 bytes,
+// so a reader can walk the mapped file directly. Line data is stored as an
+// offset table followed by one contiguous blob.
+struct SessWriter{
+    FILE* f; uint64_t pos=0; bool ok=true;
+    explicit SessWriter(FILE* fp): f(fp) {}
+    void raw(const void* p, size_t n){ if(ok && n && fwrite(p,1,n,f)!=n) ok=false; pos+=n; }
+    void u64(uint64_t v){ unsigned char b[8]; for(int i=0;i<8;i++) b[i]=(unsigned char)(v>>(8*i)); raw(b,8); }
+    void pad(){ static const char z[8]={0}; if(pos%8) raw(z, (size_t)(8-pos%8)); }
+    // Little-endian like u64, four bytes each.
+    void u32s(const vector<uint32_t>& v){
+        vector<unsigned char> b(v.size()*4);
+        for(size_t k=0;k<v.size();++k) for(int i=0;i<4;i++) b[k*4+(size_t)i]=(unsigned char)(v[k]>>(8*i));
+        raw(b.data(), b.size());
+    }
+    void str(const string& s){ u64(s.size()); raw(s.data(), s.size()); pad(); }
+    void lines(const vector<string>& L){
+        u64(L.size());
+        uint64_t off=0; u64(0);
+        for(auto& s: L){ off += s.size(); u64(off); }
+        for(auto& s: L) raw(s.data(), s.size());
+        pad();
+    }
+};
+
+struct SessReader{
+    const unsigned char* p; size_t n; size_t pos=0; bool ok=true;
+    SessReader(const unsigned char* d, size_t sz): p(d), n(sz) {}
+    bool need(uint64_t k){ if(!ok || k > n - pos){ ok=false; return false; } return true; }
+    void pad(){ size_t r = pos%8; if(r){ if(need(8-r)) pos += 8-r; } }
+    uint64_t u64(){
+        if(!need(8)) return 0;
+        uint64_t v=0; for(int i=0;i<8;i++) v |= (uint64_t)p[pos+(size_t)i]<<(8*i);
+        pos += 8; return v;
+    }
+    bool u32s(vector<uint32_t>& out, uint64_t cnt){
+        if(!ok || cnt > (n-pos)/4){ ok=false; return false; }
+        out.resize((size_t)cnt);
+        for(size_t k=0;k<out.size();++k){
+            const unsigned char* q = p + pos + k*4;
+            out[k] = (uint32_t)q[0] | (uint32_t)q[1]<<8 | (uint32_t)q[2]<<16 | (uint32_t)q[3]<<24;
+        }
+        pos += (size_t)cnt*4;
+        return true;
+    }
+    string str(){
+        uint64_t len = u64();
+        if(!need(len)) return string();
+        string s((const char*)p+pos, (size_t)len); pos += (size_t)len; pad();
+        return s;
+    }
+    bool lines(vector<string>& out){
+        uint64_t cnt = u64();
+        if(!ok || cnt > (n-pos)/8) { ok=false; return false; }
+        const unsigned char* offs = p + pos;
+        if(!need((cnt+1)*8)) return false;
+        pos += (size_t)(cnt+1)*8;
+        auto off_at = [&](uint64_t i){ uint64_t v=0; for(int k=0;k<8;k++) v |= (uint64_t)offs[i*8+(uint64_t)k]<<(8*k); return v; };
+        uint64_t total = off_at(cnt);
+        if(!need(total)) return false;
+        const char* blob = (const char*)p + pos;
+        out.clear(); out.reserve((size_t)cnt);
+        uint64_t prev = off_at(0);
+        for(uint64_t i=1;i<=cnt;i++){
+            uint64_t cur = off_at(i);
+            if(cur < prev || cur > total){ ok=false; return false; }
+            out.emplace_back(blob+prev, (size_t)(cur-prev));
+            prev = cur;
+        }
+        pos += (size_t)total; pad();
+        return ok;
+    }
+};
+
+struct MappedFile{
+    const unsigned char* data=nullptr; size_t size=0;
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile(){ if(data) munmap((void*)data, size); }
+    bool open(const string& path, string& err){
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd<0){ err = std::strerror(errno); return false; }
+        struct stat st{};
+        if(fstat(fd,&st)<0){ err = std::strerror(errno); ::close(fd); return false; }
+        size = (size_t)st.st_size;
+        if(size){
+            void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(m==MAP_FAILED){ err = "mmap: " + string(std::strerror(errno)); ::close(fd); size=0; return false; }
+            data = (const unsigned char*)m;
+        }
+        ::close(fd);
+        return true;
+    }
+};
+
+static bool valid_session_name(const string& n){
+    if(n.empty() || n[0]=='.') return false;
+    for(char c: n) if(!(std::isalnum((unsigned char)c) || c=='-' || c=='_' || c=='.')) return false;
+    return true;
+}
+
+static string session_path(const string& name){
+    return tedit_sessions_dir() + "/" + name + ".tsess";
+}
@@ -0,0 +1,90 @@
+struct StdinIngest{
+    struct State{
+        std::mutex mu;
+        vector<string> pending;
+        std::atomic<bool> done{false};
+        std::atomic<bool> cancel{false};
+        std::atomic<size_t> bytes{0};
+        std::atomic<size_t> lines{0};
+        string error;
+    };
+    std::shared_ptr<State> st;
+
+    bool active() const { return (bool)st; }
+    bool finished() const { return st && st->done.load(); }
+
+    void start(int fd){
+        st = std::make_shared<State>();
+        std::shared_ptr<State> s = st;
+        std::thread([s, fd](){
+            vector<char> chunk(1<<16);
+            string partial;
+            vector<string> batch;
+            while(!s->cancel.load()){
+                ssize_t r = ::read(fd, chunk.data(), chunk.size());
+                if(r < 0){
+                    if(errno == EINTR) continue;
+                    std::lock_guard<std::mutex> lk(s->mu);
+                    s->error = std::strerror(errno);
+                    break;
+                }
+                if(r == 0) break;
+                s->bytes += (size_t)r;
+                size_t start = 0;
+                for(size_t i=0;i<(size_t)r;++i){
+                    if(chunk[i] != '\n') continue;
+                    partial.append(chunk.data()+start, i-start);
+                    rstrip_newline(partial);
+                    batch.push_back(std::move(partial));
+                    partial.clear();
+                    start = i+1;
+                }
+                partial.append(chunk.data()+start, (size_t)r-start);
+                if(!batch.empty()){
+                    s->lines += batch.size();
+                    std::lock_guard<std::mutex> lk(s->mu);
+                    for(auto& L: batch) s->pending.push_back(std::move(L));
+                    batch.clear();
+                }
+            }
+            ::close(fd);
+            std::lock_guard<std::mutex> lk(s->mu);
+            if(!partial.empty()){
+                rstrip_newline(partial);
+                s->pending.push_back(std::move(partial));
+                s->lines++;
+            }
+            s->done = true;
+        }).detach();
+    }
+
+    size_t drain(vector<string>& into){
+        if(!st) return 0;
+        vector<string> got;
+        {
+            std::lock_guard<std::mutex> lk(st->mu);
+            got.swap(st->pending);
+        }
+        size_t n = got.size();
+        if(!n) return 0;
+        if(into.empty()) into.swap(got);
+        else into.insert(into.end(), std::make_move_iterator(got.begin()), std::make_move_iterator(got.end()));
+        return n;
+    }
+
+    string progress() const {
+        if(!st) return string();
+        std::ostringstream ss;
+        ss<<"stdin: "<<st->lines.load()<<" lines, "<<human_bytes(st->bytes.load())
+          <<(st->done.load()? " (done)" : " (receiving)");
+        return ss.str();
+    }
+
+    string error() const {
+        if(!st) return string();
+        std::lock_guard<std::mutex> lk(st->mu);
+        return st->error;
+    }
+
+    void reset(){ if(st) st->cancel = true; st.reset(); }
+};
@@ -2,31 +2,47 @@
 #include <algorithm>
 #include <cerrno>
 #include <cctype>
+#include <condition_variable>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <libgen.h>
+#include <list>
 #include <regex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #if defined(__unix__) || defined(__APPLE__)
 #include <termios.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TEDIT_SSE2 1
+#endif
 #include <filesystem>
 #include <chrono>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
 #include <random>
 #include <ctime>
+#include <unordered_map>
 #include <vector>
 
 extern "C" {
@@ -44,17 +60,31 @@ static Editor* g_editor = nullptr;
 static int l_tedit_echo(lua_State* L);
 static int l_tedit_command(lua_State* L);
 static int l_tedit_print(lua_State* L);
+static int l_tedit_grammar(lua_State* L);
 
 #include "platform.cpp"
 #include "theme.cpp"
 #include "text.cpp"
+#include "workers.cpp"
+#include "encoding.cpp"
+#include "bytesearch.cpp"
+#include "fields.cpp"
+#include "regex_engine.cpp"
 #include "buffer.cpp"
 #include "file_io.cpp"
+#include "stdin_ingest.cpp"
+#include "hexview.cpp"
+#include "session.cpp"
+#include "trigram.cpp"
 #include "ranges.cpp"
+#include "linesets.cpp"
 #include "search.cpp"
+#include "fuzzy.cpp"
 #include "filter.cpp"
 #include "listing.cpp"
+#include "grep.cpp"
 #include "highlight.cpp"
+#include "bench.cpp"
 #include "terminal.cpp"
 #include "line_reader.cpp"
 #include "editor.cpp"
@@ -21,3 +21,13 @@ static inline bool parse_long(const string& s, long& out){
 }
 
 static inline int digits_for(size_t n){ int w=1; while(n>=10){ n/=10; w++; } return w; }
+
+static string human_bytes(size_t n){
+    static const char* units[] = {"B","KB","MB","GB","TB"};
+    double v = (double)n; int u = 0;
+    while(v >= 1024.0 && u < 4){ v /= 1024.0; u++; }
+    std::ostringstream ss;
+    if(u==0) ss<<n<<" B";
+    else ss<<std::fixed<<std::setprecision(1)<<v<<" "<<units[u];
+    return ss.str();
+}
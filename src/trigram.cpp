@@ -0,0 +1,258 @@
+// Trigram index over a buffer. Lines are grouped into blocks of roughly
+// TRI_BLOCK_BYTES and every trigram (ASCII case folded, so one index serves
+// find and findi) maps to the sorted ids of the blocks containing it. A
+// query intersects the lists of its trigrams and only those blocks are
+// verified. Edited blocks are marked dirty and always verified until the
+// indexer re-reads them; the postings they no longer deserve stay behind as
+// harmless false positives until the next full rebuild.
+static const size_t TRI_BLOCK_BYTES = 64*1024;
+static const size_t TRI_SLICE_BYTES = 1024*1024;
+static const char TRI_MAGIC[8] = {'T','E','D','T','R','I','0','1'};
+
+static inline uint32_t tri_key(const unsigned char* p){
+    return (uint32_t)fold_ascii(p[0])<<16 | (uint32_t)fold_ascii(p[1])<<8 | (uint32_t)fold_ascii(p[2]);
+}
+
+struct TrigramIndex{
+    struct Block{ uint32_t id; size_t lines; bool dirty; };
+    vector<Block> blocks;
+    vector<size_t> first;           // first line (0-based) of each block
+    std::unordered_map<uint32_t, vector<uint32_t>> post;
+    uint32_t next_id = 0;
+    size_t built = 0;               // lines covered while the first build runs
+    bool ready = false;
+    size_t dirty = 0, reindexed = 0, entries = 0;
+
+    void reset(){
+        blocks.clear(); first.clear(); post.clear();
+        next_id = 0; built = 0; ready = false;
+        dirty = reindexed = entries = 0;
+    }
+
+    size_t memory() const {
+        size_t m = sizeof(*this) + blocks.capacity()*sizeof(Block) + first.capacity()*sizeof(size_t);
+        m += post.bucket_count()*sizeof(void*);
+        for(auto& kv: post) m += 32 + sizeof(kv) + kv.second.capacity()*sizeof(uint32_t);
+        return m;
+    }
+
+    // Collects the distinct trigrams of lines [lo, hi) into keys.
+    static void collect(const vector<string>& lines, size_t lo, size_t hi, vector<uint32_t>& keys){
+        static thread_local vector<uint64_t> seen(((size_t)1<<24)/64);
+        keys.clear();
+        for(size_t i=lo;i<hi;++i){
+            const string& L = lines[i];
+            if(L.size() < 3) continue;
+            const unsigned char* p = (const unsigned char*)L.data();
+            for(size_t k=0;k+3<=L.size();++k){
+                uint32_t t = tri_key(p+k);
+                uint64_t bit = 1ull << (t & 63);
+                if(seen[t>>6] & bit) continue;
+                seen[t>>6] |= bit;
+                keys.push_back(t);
+            }
+        }
+        for(uint32_t t: keys) seen[t>>6] = 0;
+    }
+
+    void add_postings(uint32_t id, const vector<uint32_t>& keys){
+        for(uint32_t t: keys){
+            auto& v = post[t];
+            if(v.empty() || v.back() < id){ v.push_back(id); entries++; continue; }
+            auto it = std::lower_bound(v.begin(), v.end(), id);
+            if(*it != id){ v.insert(it, id); entries++; }
+        }
+    }
+
+    void renumber(){
+        first.resize(blocks.size());
+        size_t at = 0;
+        for(size_t k=0;k<blocks.size();++k){ first[k] = at; at += blocks[k].lines; }
+    }
+
+    // One bounded slice of background work: extends the first build or
+    // re-reads dirty blocks. Returns true while work remains.
+    bool step(const vector<string>& lines){
+        vector<uint32_t> keys;
+        size_t budget = 0;
+        if(!ready){
+            while(built < lines.size() && budget < TRI_SLICE_BYTES){
+                size_t lo = built, bytes = 0;
+                while(built < lines.size() && bytes < TRI_BLOCK_BYTES) bytes += lines[built++].size() + 1;
+                collect(lines, lo, built, keys);
+                blocks.push_back(Block{next_id, built - lo, false});
+                add_postings(next_id++, keys);
+                budget += bytes;
+            }
+            if(built < lines.size()) return true;
+            ready = true;
+            renumber();
+            return dirty > 0;
+        }
+        if(reindexed > blocks.size()/2 + 8){ reset(); return true; }
+        for(size_t k=0; k<blocks.size() && dirty && budget < TRI_SLICE_BYTES; ++k){
+            if(!blocks[k].dirty) continue;
+            size_t lo = first[k], hi = lo + blocks[k].lines, bytes = 0;
+            for(size_t i=lo;i<hi;++i) bytes += lines[i].size() + 1;
+            if(bytes > 2*TRI_BLOCK_BYTES){
+                // Split an overgrown block; the head keeps its id.
+                vector<Block> parts;
+                size_t i = lo;
+                while(i < hi){
+                    size_t s = i, b = 0;
+                    while(i < hi && b < TRI_BLOCK_BYTES) b += lines[i++].size() + 1;
+                    parts.push_back(Block{parts.empty() ? blocks[k].id : next_id++, i - s, true});
+                }
+                dirty += parts.size() - 1;
+                blocks.erase(blocks.begin() + (long)k);
+                blocks.insert(blocks.begin() + (long)k, parts.begin(), parts.end());
+                renumber();
+                hi = lo + blocks[k].lines;
+            }
+            collect(lines, lo, hi, keys);
+            add_postings(blocks[k].id, keys);
+            blocks[k].dirty = false; dirty--; reindexed++;
+            budget += bytes;
+        }
+        return dirty > 0;
+    }
+
+    void touch(size_t k){ if(!blocks[k].dirty){ blocks[k].dirty = true; dirty++; } }
+
+    // Lines [lo, lo+old_n) (1-based) were replaced by new_n lines.
+    void lines_changed(size_t lo, size_t old_n, size_t new_n){
+        size_t at = lo ? lo - 1 : 0;
+        if(!ready){
+            if(at < built) reset();
+            return;
+        }
+        if(blocks.empty()){
+            if(new_n){ blocks.push_back(Block{next_id++, new_n, true}); dirty++; renumber(); }
+            return;
+        }
+        size_t k = (size_t)(std::upper_bound(first.begin(), first.end(), at) - first.begin()) - 1;
+        size_t off = at - first[k], rem = old_n;
+        for(size_t j=k; rem && j<blocks.size(); ++j, off=0){
+            size_t t = std::min(rem, blocks[j].lines - off);
+            blocks[j].lines -= t; rem -= t;
+            touch(j);
+        }
+        blocks[k].lines += new_n;
+        touch(k);
+        for(size_t j=0;j<blocks.size();)
+            if(blocks[j].lines == 0){ dirty--; blocks.erase(blocks.begin() + (long)j); }
+            else ++j;
+        renumber();
+    }
+    void lines_touched(const vector<size_t>& changed){
+        if(!ready){
+            for(size_t ln: changed) if(ln - 1 < built){ reset(); return; }
+            return;
+        }
+        for(size_t ln: changed){
+            auto it = std::upper_bound(first.begin(), first.end(), ln - 1);
+            if(it != first.begin()) touch((size_t)(it - first.begin()) - 1);
+        }
+    }
+
+    // Line spans that may contain q. Returns false when the index cannot
+    // narrow the search (still building, or q shorter than a trigram).
+    bool candidates(const string& q, vector<LineSpan>& spans) const {
+        spans.clear();
+        if(!ready || q.size() < 3) return false;
+        vector<const vector<uint32_t>*> lists;
+        const unsigned char* p = (const unsigned char*)q.data();
+        bool none = false;
+        for(size_t k=0;k+3<=q.size();++k){
+            auto it = post.find(tri_key(p+k));
+            if(it == post.end()){ none = true; break; }
+            lists.push_back(&it->second);
+        }
+        vector<char> hit(next_id, 0);
+        if(!none){
+            std::sort(lists.begin(), lists.end(), [](auto a, auto b){ return a->size() < b->size(); });
+            vector<uint32_t> cur = *lists[0], nxt;
+            for(size_t k=1;k<lists.size() && !cur.empty();++k){
+                nxt.clear();
+                std::set_intersection(cur.begin(), cur.end(), lists[k]->begin(), lists[k]->end(), std::back_inserter(nxt));
+                cur.swap(nxt);
+            }
+            for(uint32_t id: cur) hit[id] = 1;
+        }
+        for(size_t k=0;k<blocks.size();++k){
+            if(!blocks[k].dirty && !hit[blocks[k].id]) continue;
+            size_t lo = first[k], hi = lo + blocks[k].lines;
+            if(!spans.empty() && spans.back().second == lo) spans.back().second = hi;
+            else spans.push_back({lo, hi});
+        }
+        return true;
+    }
+
+    // Block ids are renumbered densely on save, dropping postings of blocks
+    // that no longer exist.
+    bool save(const string& path, const string& src, const FileStamp& st, size_t nlines, string& err) const {
+        if(!ready || dirty){ err = "index is not up to date"; return false; }
+        vector<uint32_t> remap(next_id, UINT32_MAX);
+        for(size_t k=0;k<blocks.size();++k) remap[blocks[k].id] = (uint32_t)k;
+        string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if(fd < 0){ err = std::strerror(errno); return false; }
+        FILE* f = fdopen(fd, "wb");
+        if(!f){ err = std::strerror(errno); ::close(fd); return false; }
+        SessWriter w(f);
+        w.raw(TRI_MAGIC, 8);
+        w.str(src);
+        w.u64((uint64_t)st.sec); w.u64((uint64_t)st.nsec); w.u64(st.size);
+        w.u64(nlines);
+        w.u64(blocks.size());
+        for(auto& b: blocks) w.u64(b.lines);
+        w.u64(post.size());
+        vector<uint32_t> ids;
+        for(auto& kv: post){
+            ids.clear();
+            for(uint32_t id: kv.second) if(remap[id] != UINT32_MAX) ids.push_back(remap[id]);
+            w.u64(kv.first); w.u64(ids.size());
+            w.u32s(ids); w.pad();
+        }
+        bool ok = w.ok && fflush(f)==0 && fsync(fileno(f))==0;
+        if(fclose(f)!=0) ok = false;
+        if(!ok || ::rename(tmp.c_str(), path.c_str())!=0){ err = std::strerror(errno); ::unlink(tmp.c_str()); return false; }
+        return true;
+    }
+
+    // Loads a saved index if it was written for this file, unchanged on
+    // disk since, with the same line count.
+    bool load(const string& path, const string& src, const FileStamp& st, size_t nlines){
+        MappedFile mf; string err;
+        if(!mf.open(path, err) || mf.size < 8 || std::memcmp(mf.data, TRI_MAGIC, 8)!=0) return false;
+        SessReader r(mf.data, mf.size); r.pos = 8;
+        if(r.str()!=src || (long long)r.u64()!=st.sec || (long long)r.u64()!=st.nsec || r.u64()!=st.size) return false;
+        if(r.u64()!=nlines) return false;
+        uint64_t nb = r.u64();
+        if(!r.ok || nb > (mf.size - r.pos)/8) return false;
+        TrigramIndex t;
+        size_t total = 0;
+        for(uint64_t k=0;k<nb;++k){ size_t n = (size_t)r.u64(); t.blocks.push_back(Block{(uint32_t)k, n, false}); total += n; }
+        if(total != nlines) return false;
+        uint64_t np = r.u64();
+        for(uint64_t k=0;k<np && r.ok;++k){
+            uint32_t key = (uint32_t)r.u64(); uint64_t n = r.u64();
+            if(!r.ok || n > (mf.size - r.pos)/sizeof(uint32_t)) return false;
+            vector<uint32_t>& v = t.post[key];
+            if(!r.u32s(v, n)) break;
+            r.pad();
+            for(uint32_t id: v) if(id >= nb) return false;
+            t.entries += (size_t)n;
+        }
+        if(!r.ok) return false;
+        t.next_id = (uint32_t)nb; t.built = nlines; t.ready = true;
+        t.renumber();
+        *this = std::move(t);
+        return true;
+    }
+};
+
+static string index_path_for(const Buffer& b){
+    string p = recover_path_for(b);
+    return p.substr(0, p.size() - strlen(".recover")) + ".tri";
+}
@@ -0,0 +1,212 @@
+// Persistent worker pool for scans over large buffers. run() hands out task
+// indices from a shared counter; the calling thread works too and returns
+// once every task has finished, so callers never see partial results.
+struct WorkerPool{
+    size_t limit = 0;
+
+    static WorkerPool& get(){ static WorkerPool pool; return pool; }
+
+    ~WorkerPool(){
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stop = true;
+        }
+        wake.notify_all();
+        for(auto& t: threads) t.join();
+    }
+
+    static size_t hardware(){
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? (size_t)n : 1;
+    }
+
+    size_t size() const { return limit ? limit : hardware(); }
+
+    void run(size_t tasks, const std::function<void(size_t)>& fn){
+        if(tasks == 0) return;
+        size_t want = std::min(size(), tasks);
+        if(want <= 1){
+            for(size_t i=0;i<tasks;++i) fn(i);
+            return;
+        }
+        std::unique_lock<std::mutex> lk(m);
+        while(threads.size() < want - 1){
+            size_t idx = threads.size();
+            threads.emplace_back([this, idx]{ loop(idx); });
+        }
+        job = &fn; total = tasks; helpers = want - 1;
+        next = 0; completed = 0; active = 0; err = nullptr;
+        gen++;
+        lk.unlock();
+        wake.notify_all();
+        work(fn);
+        lk.lock();
+        done.wait(lk, [&]{ return completed == total && active == 0; });
+        job = nullptr;
+        std::exception_ptr e = err; err = nullptr;
+        lk.unlock();
+        if(e) std::rethrow_exception(e);
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable wake, done;
+    vector<std::thread> threads;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t total = 0, helpers = 0, completed = 0, active = 0;
+    std::atomic<size_t> next{0};
+    unsigned long long gen = 0;
+    bool stop = false;
+    std::exception_ptr err;
+
+    WorkerPool() = default;
+
+    void loop(size_t idx){
+        unsigned long long seen = 0;
+        std::unique_lock<std::mutex> lk(m);
+        while(true){
+            wake.wait(lk, [&]{ return stop || gen != seen; });
+            if(stop) return;
+            seen = gen;
+            if(!job || idx >= helpers) continue;
+            const std::function<void(size_t)>* fn = job;
+            active++;
+            lk.unlock();
+            work(*fn);
+            lk.lock();
+            active--;
+            if(completed == total && active == 0) done.notify_all();
+        }
+    }
+
+    void work(const std::function<void(size_t)>& fn){
+        size_t i, n = 0;
+        while((i = next.fetch_add(1)) < total){
+            try{ fn(i); }
+            catch(...){
+                std::lock_guard<std::mutex> lk(m);
+                if(!err) err = std::current_exception();
+            }
+            n++;
+        }
+        std::lock_guard<std::mutex> lk(m);
+        completed += n;
+        if(completed == total && active == 0) done.notify_all();
+    }
+};
+
+static const size_t PAR_MIN_LINES = 20000;
+static const size_t PAR_CHUNK_LINES = 4096;
+
+typedef std::pair<size_t,size_t> LineSpan; // [lo, hi) 0-based
+
+// Calls test(line) for every line in spans[d] (sorted, disjoint) of every
+// document d and appends 1-based line numbers of hits to out[d] in order.
+// All documents share one pool run, so many small buffers cost about as
+// much as the largest one. Small inputs stay on the calling thread.
+template<class Test>
+static void parallel_multi_scan(const vector<const vector<string>*>& docs, const vector<vector<LineSpan>>& spans,
+                                const Test& test, vector<vector<size_t>>& out){
+    out.resize(docs.size());
+    size_t n = 0;
+    for(auto& sv: spans) for(auto& sp: sv) n += sp.second - sp.first;
+    WorkerPool& pool = WorkerPool::get();
+    if(n < PAR_MIN_LINES || pool.size() <= 1){
+        for(size_t d=0;d<docs.size();++d)
+            for(auto& sp: spans[d])
+                for(size_t i=sp.first;i<sp.second;++i) if(test((*docs[d])[i])) out[d].push_back(i+1);
+        return;
+    }
+    size_t chunk = std::max(PAR_CHUNK_LINES, n / (pool.size() * 8) + 1);
+    struct Piece{ size_t doc, lo, hi; };
+    vector<Piece> pieces;
+    for(size_t d=0;d<docs.size();++d)
+        for(auto& sp: spans[d])
+            for(size_t lo=sp.first; lo<sp.second; lo+=chunk) pieces.push_back({d, lo, std::min(sp.second, lo + chunk)});
+    vector<vector<size_t>> parts(pieces.size());
+    pool.run(pieces.size(), [&](size_t t){
+        const Piece& pc = pieces[t];
+        const vector<string>& lines = *docs[pc.doc];
+        auto& hits = parts[t];
+        for(size_t i=pc.lo;i<pc.hi;++i) if(test(lines[i])) hits.push_back(i+1);
+    });
+    for(size_t t=0;t<pieces.size();++t){
+        auto& dst = out[pieces[t].doc];
+        dst.insert(dst.end(), parts[t].begin(), parts[t].end());
+    }
+}
+
+template<class Test>
+static void parallel_span_scan(const vector<string>& lines, const vector<LineSpan>& spans, const Test& test, vector<size_t>& out){
+    vector<vector<size_t>> res{std::move(out)};
+    parallel_multi_scan(vector<const vector<string>*>{&lines}, vector<vector<LineSpan>>{spans}, test, res);
+    out = std::move(res[0]);
+}
+
+template<class Test>
+static void parallel_line_scan(const vector<string>& lines, const Test& test, vector<size_t>& out){
+    parallel_span_scan(lines, vector<LineSpan>{{0, lines.size()}}, test, out);
+}
+
+// Background thread that runs a job in short slices, but only while the
+// editor is idle at the prompt. pause() returns once the current slice has
+// finished, so the caller can mutate buffers safely until resume().
+struct IdleWorker{
+    IdleWorker() = default;
+    IdleWorker(const IdleWorker&) = delete;
+    IdleWorker& operator=(const IdleWorker&) = delete;
+    ~IdleWorker(){ stop(); }
+
+    // `slice` does a bounded amount of work and returns true if more remains.
+    void start(std::function<bool()> slice){
+        job = std::move(slice);
+        th = std::thread([this]{ loop(); });
+    }
+    void stop(){
+        if(!th.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            quit = true;
+        }
+        cv.notify_all();
+        th.join();
+    }
+    void kick(){
+        std::lock_guard<std::mutex> lk(m);
+        pending = true;
+        cv.notify_all();
+    }
+    void resume(){
+        std::lock_guard<std::mutex> lk(m);
+        if(++depth_idle > 0) running = true;
+        cv.notify_all();
+    }
+    void pause(){
+        std::unique_lock<std::mutex> lk(m);
+        if(--depth_idle <= 0) running = false;
+        cv.wait(lk, [&]{ return !busy || running; });
+    }
+
+private:
+    std::thread th;
+    std::mutex m;
+    std::condition_variable cv;
+    std::function<bool()> job;
+    bool running = false, busy = false, pending = false, quit = false;
+    int depth_idle = 0;
+
+    void loop(){
+        std::unique_lock<std::mutex> lk(m);
+        while(true){
+            cv.wait(lk, [&]{ return quit || (running && pending); });
+            if(quit) return;
+            busy = true;
+            lk.unlock();
+            bool more = job();
+            lk.lock();
+            busy = false;
+            if(!more) pending = false;
+            cv.notify_all();
+        }
+    }
+};
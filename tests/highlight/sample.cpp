@@ -0,0 +1,9 @@
+#include "x.h" // header
+int main(){ const char* s = "a // not a comment"; return 0; } // tail while
+static int k = 1; /* one-line block */ struct S {};
+void f(); /* block comment
+   spanning lines with return and "quotes"
+   ends here */ while(k) { break; }
+char c = "esc \" still string"; typedef int T;
+unterminated "string with if inside
+identifiers like returned and classy are not keywords
@@ -0,0 +1,6 @@
+function f(a) { return a ?? null; } // js comment
+const s = 'single', t = "double // still";
+let tpl = `template ${x}
+spans lines with if inside`; var y = undefined;
+/* block
+comment */ export default f;
@@ -0,0 +1,8 @@
+def f(x): # comment with "quote"
+    s = 'it''s' if x else None
+    doc = """triple
+    return inside docstring
+    """
+    return "# not a comment"
+t = '''single triple''' ; pass
+async def g(): await h()
@@ -0,0 +1,4 @@
+class Foo < Bar # ruby comment
+  def initialize(x) self.x = x end
+  puts "nil here" if x.nil?
+end
@@ -0,0 +1,5 @@
+#!/bin/sh
+echo "$HOME" ${PATH} $user_1 # trailing comment
+url=a#b
+for f in *.txt; do echo "$f"; done
+if [ -z "$x" ]; then exit 1; fi